@@ -0,0 +1,457 @@
+//
+// Resampling of many granules listed in a manifest file
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "viirsresam.h"
+
+struct Granule;
+
+// File resampled in a batch and its result.
+struct BatchFile {
+	const char	*geofile;	// NULL for netCDF files
+	const char	*file;
+	Granule	*granule;
+	BandJob	*job;	// band being resampled in stages, or NULL
+	bool	whole;	// resampled by viirs_resample_file in the compute stage
+	bool	tcswath;	// GMTCO file resampled with the plan in the compute stage
+	Seam	*seam;	// with opts->stitch, rows of the neighboring granules, or NULL
+	Status	st;
+	double	secs;	// time taken, summed over the stages
+};
+
+// Granule given by a line of the manifest.
+struct Granule {
+	char	*line;	// manifest line, holding the file names
+	vector<BatchFile>	files;
+	GeoPlan	*plan;	// geolocation shared by the band files
+	int	nwritten;	// files done by the write stage
+	Granule	*prev, *next;	// neighbors in the swath with opts->stitch, or NULL
+};
+
+// Files go through three stages: the main thread reads them (readstage),
+// the worker threads resample them (computestage), and a writer thread
+// writes them back (writestage). The queues between the stages are
+// bounded, so reading doesn't run far ahead of resampling.
+struct Batch {
+	const ResamOpts	*opts;
+	Queue	*computeq;	// files read, to be resampled
+	Queue	*writeq;	// files resampled, to be written
+	FILE	*summary;	// only used by the writer thread
+	int	nfailed, nskipped;
+	Seam	carry[NBANDS+1];	// with opts->stitch, last rows of the files of the granule read last, by seamkind
+};
+
+static double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+// Resample file with geolocation file geofile according to the file type
+// of file: band file, terrain-corrected geolocation file, or, if geofile
+// is NULL, an ACSPO or L2P GHRSST file.
+//
+Status
+viirs_resample_file(const char *geofile, const char *file, const ResamOpts *opts)
+{
+	Status st = {STATUS_OK, ""};
+	Report report;
+
+	// bands and GMTCO files end their own report
+	report_init(&report);
+	switch(getfiletype(file)){
+	case L2P_GHRSST:
+		st = viirs_reorder_ghrsst(file);
+		break;
+	case ACSPO:
+		st = viirs_reorder_acspo(file);
+		break;
+	case GMTCO:
+		if(geofile != NULL){
+			return viirs_resample_tcgeo(geofile, file, opts);
+		}
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "no geolocation file for %s", file);
+		break;
+	default:
+		if(geofile != NULL){
+			return viirs_resample_band(geofile, file, opts);
+		}
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "no geolocation file for %s", file);
+		break;
+	}
+	report_end(opts->report, &report, geofile, file, &st);
+	return st;
+}
+
+// Whether a band file of granule g, or a GMTCO file with opts->stitch,
+// is left to resample, going by the resampling attributes, so that its
+// geolocation must be read.
+//
+static bool
+bandstodo(Batch *b, Granule *g)
+{
+	for(int i = 0; i < (int)g->files.size(); i++){
+		BatchFile *f = &g->files[i];
+		bool done;
+
+		int type = getfiletype(f->file);
+		if(f->geofile == NULL || (type == GMTCO && !b->opts->stitch) || type == ACSPO || type == L2P_GHRSST){
+			continue;
+		}
+		if(b->opts->force || viirs_resampled(f->file, &done).code != STATUS_OK || !done){
+			return true;
+		}
+	}
+	return false;
+}
+
+// Kind of the files carried over between the granules of a swath:
+// the band number, 0 for GMTCO files, or -1 for files not stitched.
+static int
+seamkind(const char *file)
+{
+	switch(getfiletype(file)){
+	case GMTCO:
+		return 0;
+	case GMODO:
+	case ACSPO:
+	case L2P_GHRSST:
+		return -1;
+	}
+	int is = getbandname(file);
+	return is >= 1 && is <= NBANDS ? is : -1;
+}
+
+// File of granule g of the given kind, or NULL.
+static const char*
+kindfile(const Granule *g, int kind)
+{
+	if(g == NULL){
+		return NULL;
+	}
+	for(int i = 0; i < (int)g->files.size(); i++){
+		if(g->files[i].geofile != NULL && seamkind(g->files[i].file) == kind){
+			return g->files[i].file;
+		}
+	}
+	return NULL;
+}
+
+// Geolocation file of granule g, or NULL.
+static const char*
+geofileof(const Granule *g)
+{
+	if(g == NULL || g->files.empty()){
+		return NULL;
+	}
+	return g->files[0].geofile;
+}
+
+// Read the files of granule g, and queue them to be resampled.
+// The geolocation is read only once for all the band files, unless
+// a region is given, and not at all if they were all already resampled.
+// Files other than bands are read, resampled and written by
+// viirs_resample_file in the compute stage.
+//
+// With opts->stitch, the rows the files share with the neighboring
+// granules are read first, while the files of the next granule
+// are not resampled yet, and GMTCO files are resampled with the plan.
+//
+static void
+readstage(Batch *b, Granule *g)
+{
+	Status planst = {STATUS_OK, ""};
+	bool needplan = b->opts->region == NULL && bandstodo(b, g);
+	bool carried[NBANDS+1];
+
+	for(int k = 0; k <= NBANDS; k++){
+		carried[k] = false;
+	}
+	for(int i = 0; i < (int)g->files.size(); i++){
+		BatchFile *f = &g->files[i];
+
+		double t0 = now();
+		int type = getfiletype(f->file);
+		int kind = seamkind(f->file);
+		if(b->opts->stitch && f->geofile != NULL && kind >= 0){
+			f->seam = new Seam;
+			Status st = viirs_seam_read(f->file, kindfile(g->next, kind), &b->carry[kind], f->seam, b->opts);
+			if(st.code != STATUS_OK){
+				fprintf(stderr, "%s not stitched: %s\n", f->file, st.msg);
+			}
+			carried[kind] = true;
+		}
+		if(f->geofile == NULL || type == ACSPO || type == L2P_GHRSST
+		|| (type == GMTCO && (f->seam == NULL || !needplan))){
+			f->whole = true;
+		}else if(b->opts->region != NULL || !needplan){
+			// without a plan; files already resampled are skipped
+			f->st = viirs_band_read(f->geofile, NULL, f->file, b->opts, &f->job);
+		}else{
+			if(g->plan == NULL && planst.code == STATUS_OK){
+				if(b->opts->stitch){
+					planst = viirs_geoplan_swath(geofileof(g->prev), f->geofile, geofileof(g->next), &g->plan);
+				}else{
+					planst = viirs_geoplan_create(f->geofile, &g->plan);
+				}
+			}
+			if(g->plan != NULL && type == GMTCO){
+				f->tcswath = true;
+			}else if(g->plan != NULL && f->seam != NULL){
+				f->st = viirs_band_read_swath(g->plan, f->file, f->seam, b->opts, &f->job);
+			}else if(g->plan != NULL){
+				f->st = viirs_band_read(NULL, g->plan, f->file, b->opts, &f->job);
+			}else{
+				f->st = planst;
+				Report report;
+				report_init(&report);
+				report_end(b->opts->report, &report, f->geofile, f->file, &f->st);
+			}
+		}
+		f->secs += now() - t0;
+		queue_put(b->computeq, f);
+	}
+
+	// the next granule's files of other kinds have no rows to stitch to
+	for(int k = 0; k <= NBANDS; k++){
+		if(!carried[k]){
+			b->carry[k].top.clear();
+		}
+	}
+}
+
+// Worker resampling the files read until the compute queue is closed.
+//
+static void
+computestage(void *arg)
+{
+	Batch *b = (Batch*)arg;
+	BatchFile *f;
+
+	while((f = (BatchFile*)queue_get(b->computeq)) != NULL){
+		double t0 = now();
+		if(f->whole){
+			f->st = viirs_resample_file(f->geofile, f->file, b->opts);
+		}else if(f->tcswath){
+			f->st = viirs_resample_tcgeo_swath(f->granule->plan, f->file, f->seam, b->opts);
+		}else if(f->job != NULL){
+			f->st = viirs_band_compute(f->job);
+		}
+		f->secs += now() - t0;
+		queue_put(b->writeq, f);
+	}
+}
+
+// Write the resampled files until the write queue is closed, and
+// record them in the summary. The geolocation of a granule is freed
+// after its last file.
+//
+static void*
+writestage(void *arg)
+{
+	Batch *b = (Batch*)arg;
+	BatchFile *f;
+
+	while((f = (BatchFile*)queue_get(b->writeq)) != NULL){
+		Granule *g = f->granule;
+
+		double t0 = now();
+		if(f->job != NULL){
+			if(f->st.code == STATUS_OK){
+				f->st = viirs_band_write(f->job);
+			}
+			viirs_band_free(f->job);
+			f->job = NULL;
+		}
+		delete f->seam;
+		f->seam = NULL;
+		f->secs += now() - t0;
+
+		if(f->st.code != STATUS_OK){
+			b->nfailed++;
+		}else if(f->st.skipped){
+			b->nskipped++;
+		}
+		fprintf(b->summary, "%s\t%.3f\t%s\t%s\t%s\n",
+			f->st.code != STATUS_OK ? "FAIL" : f->st.skipped ? "skip" : "ok",
+			f->secs,
+			f->geofile != NULL ? f->geofile : "-",
+			f->file,
+			f->st.msg);
+		fflush(b->summary);
+
+		if(++g->nwritten == (int)g->files.size()){
+			metrics_granule();
+			viirs_geoplan_free(g->plan);
+			g->plan = NULL;
+		}
+	}
+	return NULL;
+}
+
+// Split the manifest line into the files of granule g.
+// The line is "geofile file..." or a single ACSPO/GHRSST file.
+// Returns false for blank lines and comments.
+//
+static bool
+parseline(char *line, Granule *g)
+{
+	vector<char*> f;
+	char *s, *tok;
+
+	if((s = strchr(line, '#')) != NULL){
+		*s = '\0';
+	}
+	for(tok = strtok_r(line, " \t\r\n", &s); tok != NULL; tok = strtok_r(NULL, " \t\r\n", &s)){
+		f.push_back(tok);
+	}
+	if(f.empty()){
+		return false;
+	}
+
+	BatchFile bf;
+	memset(&bf, 0, sizeof(bf));
+	bf.granule = g;
+	if(f.size() == 1){
+		bf.file = f[0];
+		g->files.push_back(bf);
+		return true;
+	}
+	bf.geofile = f[0];
+	for(int i = 1; i < (int)f.size(); i++){
+		bf.file = f[i];
+		g->files.push_back(bf);
+	}
+	return true;
+}
+
+// Resample the granules listed in file manifest using nthreads worker
+// threads, while the files are read ahead and written back by two more
+// threads. Each line of the manifest has a GMODO file followed by the
+// band and GMTCO files to resample with it, or a single ACSPO or L2P
+// GHRSST file. Blank lines and text after '#' are ignored.
+//
+// With opts->stitch, the lines of the manifest are consecutive granules
+// of a swath, in order, and each granule is resampled with the rows of
+// its neighbors as if the swath were a single granule (see stitch.cc).
+// The neighbors are checked to follow on from each other, going by
+// their geolocation.
+//
+// A line of the summary file is written for each file as it finishes,
+// with tab separated fields: ok, FAIL, or skip if the file was already
+// resampled (see viirs_resampled), seconds taken by the stages
+// (not counting time spent in the queues), geolocation file,
+// file, error message. Failed files don't stop the others from being
+// resampled, but make the returned status an error.
+//
+Status
+viirs_run_batch(const char *manifest, int nthreads, const char *summary, const ResamOpts *opts)
+{
+	Status st = {STATUS_OK, ""};
+	vector<Granule*> granules;
+	char *line = NULL;
+	size_t linecap = 0;
+	int nfiles;
+	Batch b;
+
+	FILE *f = fopen(manifest, "r");
+	if(f == NULL){
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "open %s failed: %s", manifest, strerror(errno));
+		return st;
+	}
+	nfiles = 0;
+	while(getline(&line, &linecap, f) != -1){
+		Granule *g = new Granule;
+		g->line = strdup(line);
+		g->plan = NULL;
+		g->nwritten = 0;
+		if(!parseline(g->line, g)){
+			free(g->line);
+			delete g;
+			continue;
+		}
+		nfiles += g->files.size();
+		granules.push_back(g);
+	}
+	free(line);
+	fclose(f);
+	for(int i = 0; i < (int)granules.size(); i++){
+		granules[i]->prev = opts->stitch && i > 0 ? granules[i-1] : NULL;
+		granules[i]->next = opts->stitch && i+1 < (int)granules.size() ? granules[i+1] : NULL;
+	}
+
+	b.opts = opts;
+	b.nfailed = 0;
+	b.nskipped = 0;
+	b.summary = fopen(summary, "w");
+	if(b.summary == NULL){
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "open %s failed: %s", summary, strerror(errno));
+	}else{
+		fprintf(b.summary, "# status\tseconds\tgeofile\tfile\terror\n");
+		fflush(b.summary);
+
+		double t0 = now();
+		b.computeq = queue_create(nthreads);
+		b.writeq = queue_create(nthreads);
+		pthread_t writer;
+		int n = pthread_create(&writer, NULL, writestage, &b);
+		if(n != 0){
+			st.code = STATUS_ERROR;
+			snprintf(st.msg, sizeof(st.msg), "pthread_create failed: %s", strerror(n));
+		}else{
+			// computeq is closed and the workers joined even after an
+			// error, before the queues are freed under them
+			Pool *pool = NULL;
+			try{
+				pool = pool_create(nthreads);
+				for(int i = 0; i < nthreads; i++){
+					pool_submit(pool, computestage, &b);
+				}
+				for(int i = 0; i < (int)granules.size(); i++){
+					readstage(&b, granules[i]);
+				}
+			}catch(const std::exception &e){
+				st.code = STATUS_ERROR;
+				snprintf(st.msg, sizeof(st.msg), "%s", e.what());
+			}
+			queue_close(b.computeq);
+			if(pool != NULL){
+				pool_destroy(pool);
+			}
+			queue_close(b.writeq);
+			pthread_join(writer, NULL);
+		}
+		queue_free(b.computeq);
+		queue_free(b.writeq);
+		double secs = now() - t0;
+
+		fprintf(b.summary, "# %d granules, %d files, %d failed, %d skipped, %.3f seconds, %d threads\n",
+			(int)granules.size(), nfiles, b.nfailed, b.nskipped, secs, nthreads);
+		if(fclose(b.summary) != 0 && st.code == STATUS_OK){
+			st.code = STATUS_ERROR;
+			snprintf(st.msg, sizeof(st.msg), "write %s failed: %s", summary, strerror(errno));
+		}
+		if(b.nfailed > 0 && st.code == STATUS_OK){
+			st.code = STATUS_ERROR;
+			snprintf(st.msg, sizeof(st.msg), "%d of %d files failed; see %s", b.nfailed, nfiles, summary);
+		}
+	}
+
+	for(int i = 0; i < (int)granules.size(); i++){
+		free(granules[i]->line);
+		delete granules[i];
+	}
+	return st;
+}
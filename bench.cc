@@ -0,0 +1,711 @@
+//
+// Benchmark of the resampling kernels on synthetic granules
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "viirsresam.h"
+
+char *progname;
+
+// Synthetic granule and the intermediates of resampling it.
+struct Bench {
+	int	width, height;
+	double	scale, offset;
+	Mat	lat, lon;	// geolocation
+	Mat	band;	// CV_16UC1 band image, like M15
+	Mat	band13;	// CV_32FC1 band image, like M13
+	Mat	sind;	// sorting indices
+	Mat	slat, slon;	// sorted geolocation
+	Mat	sband;	// sorted band
+	Mat	phys;	// band in physical units
+	Mat	sphys;	// sorted phys
+	Mat	sindT, slonT, lonT, ilonT;	// transposed for interplon
+	vector<Mat>	rphys;	// resampled sphys
+	Mat	ilon;
+	Mat	out;	// requantized band
+};
+
+// Make a synthetic granule of the given height with the bow-tie
+// geometry of VIIRS: the footprints of the detectors of a scan grow
+// towards the edges of the swath, so that neighboring scans overlap
+// there and the latitude within a column is out of order. The band has
+// the on-board deleted pixels at the edges of the first and last two
+// detectors of each scan, plus a sprinkling of missing pixels.
+//
+static void
+synthgranule(Bench *b, int height)
+{
+	b->width = VIIRS_WIDTH;
+	b->height = height;
+	b->scale = 0.0025;
+	b->offset = 200;
+	b->lat.create(height, b->width, CV_32FC1);
+	b->lon.create(height, b->width, CV_32FC1);
+	b->band.create(height, b->width, CV_16UC1);
+	b->band13.create(height, b->width, CV_32FC1);
+
+	srand(1);
+	for(int y = 0; y < height; y++){
+		float *lat = b->lat.ptr<float>(y);
+		float *lon = b->lon.ptr<float>(y);
+		ushort *band = b->band.ptr<ushort>(y);
+		float *band13 = b->band13.ptr<float>(y);
+		int scan = y/NDETECTORS;
+		int det = y%NDETECTORS;
+
+		for(int x = 0; x < b->width; x++){
+			double u = (x - (b->width-1)/2.0)/(b->width/2.0);	// -1 to 1 across the swath
+			double step = 1 + 1.5*SQ(u);	// detector footprint, in nadir rows
+			double along = scan*NDETECTORS + (det - (NDETECTORS-1)/2.0)*step + 0.3*u;
+
+			lat[x] = 30 + along*0.0067;
+			lon[x] = 179.5 + (x - b->width/2)*0.007*(1 + SQ(u)) + along*0.001;
+			if(lon[x] > 180)
+				lon[x] -= 360;
+
+			double bt = 280 + 10*sin(lat[x]*3) + 5*cos(x*0.003) + (rand()%100)/100.0;
+			band[x] = (ushort)((bt - b->offset)/b->scale);
+			band13[x] = bt;
+			if((det < 2 || det >= NDETECTORS-2) && fabs(u) > 0.65 + 0.15*(det == 1 || det == NDETECTORS-2)){
+				band[x] = DELETION_ZONE_INT;
+				band13[x] = DELETION_ZONE_FLOAT;
+			}else if(rand()%5000 == 0){
+				band[x] = NA_UINT16_FILL;
+				band13[x] = NA_FLOAT32_FILL;
+			}
+		}
+	}
+}
+
+// Compute the intermediates the stages take as input, so that each
+// stage can be timed on its own.
+//
+static void
+setup(Bench *b)
+{
+	getadjustedsortingind(b->sind, b->lat);
+	b->slat = resample_sort(b->sind, b->lat);
+	b->slon = resample_sort(b->sind, b->lon);
+	b->sband = resample_sort(b->sind, b->band);
+	b->phys.create(b->height, b->width, CV_32FC1);
+	band2physbuf(b->band.ptr<ushort>(0), b->width*b->height, b->scale, b->offset, b->phys.ptr<float>(0));
+	b->sphys = resample_sort(b->sind, b->phys);
+	transpose(b->sind, b->sindT);
+	transpose(b->slon, b->slonT);
+	transpose(b->lon, b->lonT);
+	b->ilonT.create(b->width, b->height, CV_32FC1);
+	vector<Mat> src(1, b->sphys);
+	resample2d(b->sind, src, b->slat, b->slon, b->lon, false, b->rphys, b->ilon);
+	b->out.create(b->height, b->width, CV_16UC1);
+}
+
+static void
+st_sortind(Bench *b)
+{
+	Mat sind;
+	getadjustedsortingind(sind, b->lat);
+}
+
+static void
+st_sort(Bench *b)
+{
+	Mat s = resample_sort(b->sind, b->band);
+}
+
+static void
+st_interplon(Bench *b)
+{
+	for(int j = 0; j < b->width; j++){
+		interplon(b->sindT.ptr<int>(j), b->slonT.ptr<float>(j), b->lonT.ptr<float>(j),
+			b->height, b->ilonT.ptr<float>(j));
+	}
+}
+
+static void
+st_resample2d(Bench *b)
+{
+	vector<Mat> src(1, b->sphys), dst;
+	Mat ilon;
+	resample2d(b->sind, src, b->slat, b->slon, b->lon, false, dst, ilon);
+}
+
+static void
+st_band2phys(Bench *b)
+{
+	band2physbuf(b->band.ptr<ushort>(0), b->width*b->height, b->scale, b->offset, b->phys.ptr<float>(0));
+}
+
+static void
+st_phys2band(Bench *b)
+{
+	phys2bandbuf(b->rphys[0].ptr<float>(0), b->sband.ptr<ushort>(0), b->sind, b->width, b->height,
+		b->scale, b->offset, false, b->out.ptr<ushort>(0));
+}
+
+static void
+st_staged(Bench *b)
+{
+	Mat img = b->phys.clone();
+	Mat lat = b->lat.clone();
+	Mat lon = b->lon.clone();
+	resample_viirs_mat(img, lat, lon, true, false);
+}
+
+static void
+st_fused(Bench *b)
+{
+	Mat img = b->band.clone();
+	resample_band_fused(b->sind, img, b->lat, b->lon, b->scale, b->offset, false, NULL, NULL, NULL);
+}
+
+static void
+st_fused13(Bench *b)
+{
+	Mat img = b->band13.clone();
+	resample_band_fused(b->sind, img, b->lat, b->lon, 1, 0, false, NULL, NULL, NULL);
+}
+
+struct Stage {
+	const char	*name;
+	void	(*fn)(Bench *b);
+};
+
+static Stage stages[] = {
+	{"getadjustedsortingind", st_sortind},
+	{"resample_sort", st_sort},
+	{"interplon", st_interplon},
+	{"resample2d", st_resample2d},
+	{"band2physbuf", st_band2phys},
+	{"phys2bandbuf", st_phys2band},
+	{"resample_viirs_mat", st_staged},
+	{"resample_band_fused", st_fused},
+	{"resample_band_fused M13", st_fused13},
+};
+
+// Reference implementations for -c: the resampling as it was first
+// written, in double precision one pixel at a time, with no caching
+// of weights or trigonometry. The optimized paths are checked
+// against them.
+
+static double
+refgeodist(double lat1, double lon1, double lat2, double lon2)
+{
+	const double R = 6371.0;
+	double phi1 = (M_PI * lat1) / 180.0;
+	double phi2 = (M_PI * lat2) / 180.0;
+	double lam1 = (M_PI * lon1) / 180.0;
+	double lam2 = (M_PI * lon2) / 180.0;
+	double delta_phi = phi1 - phi2;
+	double delta_lam = lam1 - lam2;
+	if(lam2*lam1 < 0){	// crossing meridian
+		delta_lam = -lam1 - lam2;
+	}
+	return R*sqrt(SQ(cos((phi1+phi2)/2) * delta_lam) + SQ(delta_phi));
+}
+
+static double
+refgeoapprox(const float *T, const float *lat, const float *lon, float targlat, float targlon, double res)
+{
+	if(isnan(T[0]) && isnan(T[1]) && isnan(T[2]))
+		return NAN;	// DELETION_ZONE_VALUE
+	if(isnan(T[0]) && isnan(T[1]))
+		return T[2];
+	if(isnan(T[0]) && isnan(T[2]))
+		return T[1];
+	if(isnan(T[1]) && isnan(T[2]))
+		return T[0];
+
+	double sqres = SQ(res);
+	double num = 0;
+	double denom = 0;
+	for(int i = 0; i < 3; i++){
+		if(!isnan(T[i])){
+			double d = refgeodist(targlat, targlon, lat[i], lon[i]);
+			double w = exp(-SQ(d) / sqres);
+			num += T[i] * w;
+			denom += w;
+		}
+	}
+	return num/denom;
+}
+
+// Interpolation at x between longitudes y0 at x0 and y1 at x1, in radians.
+static double
+reflinearinterp(double x0, double y0, double x1, double y1, double x)
+{
+	double lam = (x - x0)/(x1 - x0);
+	double lam1 = 1-lam;
+	return atan2(lam1*sin(y0) + lam*sin(y1), lam1*cos(y0) + lam*cos(y1));
+}
+
+static void
+refinterplon(const int *sind, const float *slon, const float *lon, int n, float *dst)
+{
+	vector<int> buf;
+	int i;
+
+	for(i = 0; i < n; i++){
+		if(sind[i] == i)
+			break;
+		buf.push_back(i);
+	}
+	for(int j = 0; j < (int)buf.size(); j++){
+		dst[buf[j]] = slon[i];
+	}
+	buf.clear();
+	double prevkeep = i;
+	double prevlon = RADIANCE(slon[i]);
+
+	for(; i < n; i++){
+		if(i%NDETECTORS == NDETECTORS/2){
+			double curkeep = i-0.5;
+			double phi1 = RADIANCE(lon[i]);
+			double phi2 = RADIANCE(lon[i-1]);
+			double curlon = atan2((sin(phi1) + sin(phi2))/2.0, (cos(phi1) + cos(phi2))/2.0);
+			for(int j = 0; j < (int)buf.size(); j++){
+				int k = buf[j];
+				dst[k] = DEGREE(reflinearinterp(prevkeep, prevlon, curkeep, curlon, k));
+			}
+			buf.clear();
+			prevkeep = curkeep;
+			prevlon = curlon;
+		}
+		if(sind[i] == i){
+			for(int j = 0; j < (int)buf.size(); j++){
+				int k = buf[j];
+				dst[k] = DEGREE(reflinearinterp(prevkeep, prevlon, i, RADIANCE(slon[i]), k));
+			}
+			buf.clear();
+			prevkeep = i;
+			prevlon = RADIANCE(slon[i]);
+			dst[i] = slon[i];
+		}else{
+			buf.push_back(i);
+		}
+	}
+	for(int j = 0; j < (int)buf.size(); j++){
+		dst[buf[j]] = DEGREE(prevlon);
+	}
+}
+
+template <class T>
+static Mat
+refsort(const Mat &sind, const Mat &img)
+{
+	Mat dst(img.rows, img.cols, img.type());
+
+	for(int i = 0; i < img.rows; i++){
+		for(int j = 0; j < img.cols; j++){
+			dst.at<T>(i, j) = img.at<T>(sind.at<int>(i, j), j);
+		}
+	}
+	return dst;
+}
+
+// Resample the sorted physical image sphys, with the sorted geolocation
+// slat and slon of granule b.
+static Mat
+refresample(Bench *b, const Mat &sphys, const Mat &slat, const Mat &slon, bool gaponly)
+{
+	int width = sphys.cols, height = sphys.rows;
+	vector<int> sind(height);
+	vector<float> sval(height), lat(height), lon(height), ulon(height), ilon(height);
+	Mat dst(height, width, CV_32FC1);
+
+	for(int j = 0; j < width; j++){
+		for(int i = 0; i < height; i++){
+			sind[i] = b->sind.at<int>(i, j);
+			sval[i] = sphys.at<float>(i, j);
+			lat[i] = slat.at<float>(i, j);
+			lon[i] = slon.at<float>(i, j);
+			ulon[i] = b->lon.at<float>(i, j);
+		}
+		refinterplon(&sind[0], &lon[0], &ulon[0], height, &ilon[0]);
+		double x = 2*j/(double)width - 1.0;
+		double res = 0.1*SQ(x) + 0.1;
+		dst.at<float>(0, j) = sval[0];
+		for(int i = 1; i < height-1; i++){
+			if(gaponly && sind[i] == i && !isnan(sval[i])){
+				dst.at<float>(i, j) = sval[i];
+			}else{
+				dst.at<float>(i, j) = refgeoapprox(&sval[i-1], &lat[i-1], &lon[i-1], lat[i], ilon[i], res);
+			}
+		}
+		dst.at<float>(height-1, j) = sval[height-1];
+	}
+	return dst;
+}
+
+// Resample band image band (CV_16UC1 or CV_32FC1) of granule b,
+// returning the band values in sorted order, as written by viirsresam.
+static Mat
+refband(Bench *b, const Mat &band, double scale, double offset, bool gaponly)
+{
+	bool is16 = band.type() == CV_16UC1;
+	Mat phys(band.rows, band.cols, CV_32FC1);
+
+	for(int i = 0; i < band.rows; i++){
+		for(int j = 0; j < band.cols; j++){
+			if(is16){
+				ushort v = band.at<ushort>(i, j);
+				phys.at<float>(i, j) = isushortfill(v) ? NAN : scale*v + offset;
+			}else{
+				float v = band.at<float>(i, j);
+				phys.at<float>(i, j) = isfloatfill(v) ? NAN : v;
+			}
+		}
+	}
+	Mat slat = refsort<float>(b->sind, b->lat);
+	Mat slon = refsort<float>(b->sind, b->lon);
+	Mat rphys = refresample(b, refsort<float>(b->sind, phys), slat, slon, gaponly);
+	Mat sband = is16 ? refsort<ushort>(b->sind, band) : refsort<float>(b->sind, band);
+
+	Mat out(band.rows, band.cols, band.type());
+	for(int i = 0; i < band.rows; i++){
+		for(int j = 0; j < band.cols; j++){
+			float v = rphys.at<float>(i, j);
+			bool kept = b->sind.at<int>(i, j) == i;
+			if(is16){
+				ushort raw = sband.at<ushort>(i, j);
+				if((gaponly && kept && !isushortfill(raw))
+				|| (isushortfill(raw) && raw != DELETION_ZONE_INT) || isnan(v)){
+					out.at<ushort>(i, j) = raw;
+				}else{
+					int k = (int) round((v - offset)/scale);
+					out.at<ushort>(i, j) = k < 0 ? 0 : k > 65535 ? 65535 : k;
+				}
+			}else{
+				float raw = sband.at<float>(i, j);
+				if((isfloatfill(raw) && raw != DELETION_ZONE_FLOAT) || isnan(v)){
+					out.at<float>(i, j) = raw;
+				}else{
+					out.at<float>(i, j) = v;
+				}
+			}
+		}
+	}
+	return out;
+}
+
+// Resample band with the staged path of viirsresam.
+static Mat
+stagedband(Bench *b, const Mat &band, double scale, double offset, bool gaponly)
+{
+	Mat phys(band.rows, band.cols, CV_32FC1);
+	Mat out(band.rows, band.cols, band.type());
+	Mat lat = b->lat.clone();
+	Mat lon = b->lon.clone();
+	int n = band.rows*band.cols;
+
+	if(band.type() == CV_16UC1){
+		band2physbuf(band.ptr<ushort>(0), n, scale, offset, phys.ptr<float>(0));
+	}else{
+		band2physbuf(band.ptr<float>(0), n, scale, offset, phys.ptr<float>(0));
+	}
+	resample_viirs_mat(phys, lat, lon, true, gaponly);
+	Mat sband = resample_sort(b->sind, band);
+	if(band.type() == CV_16UC1){
+		phys2bandbuf(phys.ptr<float>(0), sband.ptr<ushort>(0), b->sind, band.cols, band.rows,
+			scale, offset, gaponly, out.ptr<ushort>(0));
+	}else{
+		phys2bandbuf(phys.ptr<float>(0), sband.ptr<float>(0), b->sind, band.cols, band.rows,
+			scale, offset, gaponly, out.ptr<float>(0));
+	}
+	return out;
+}
+
+// Resample band with the fused path of viirsresam -f.
+static Mat
+fusedband(Bench *b, const Mat &band, double scale, double offset, bool gaponly)
+{
+	Mat img = band.clone();
+
+	resample_band_fused(b->sind, img, b->lat, b->lon, scale, offset, gaponly, NULL, NULL, NULL);
+	return img;
+}
+
+struct Path {
+	const char	*name;
+	Mat	(*fn)(Bench *b, const Mat &band, double scale, double offset, bool gaponly);
+};
+
+static Path paths[] = {
+	{"staged", stagedband},
+	{"fused", fusedband},
+};
+
+// Differences of a band image from the reference.
+struct Diff {
+	double	maxerr, sumerr;	// in physical units, over the values valid in both
+	double	nerr;	// values in sumerr
+	double	ndiff;	// values not the same
+	double	nfill;	// values fill or NAN in only one of them
+};
+
+static void
+diffband(const Mat &out, const Mat &ref, double scale, Diff *d)
+{
+	memset(d, 0, sizeof(*d));
+	for(int i = 0; i < ref.rows; i++){
+		for(int j = 0; j < ref.cols; j++){
+			bool fo, fr;
+			double e;
+			if(ref.type() == CV_16UC1){
+				ushort o = out.at<ushort>(i, j), r = ref.at<ushort>(i, j);
+				d->ndiff += o != r;
+				fo = isushortfill(o);
+				fr = isushortfill(r);
+				e = scale*fabs((double)o - r);
+			}else{
+				float o = out.at<float>(i, j), r = ref.at<float>(i, j);
+				fo = isfloatfill(o) || isnan(o);
+				fr = isfloatfill(r) || isnan(r);
+				d->ndiff += o != r && !(isnan(o) && isnan(r));
+				e = fabs((double)o - r);
+			}
+			if(fo != fr){
+				d->nfill++;
+			}else if(!fo){
+				d->maxerr = MAX(d->maxerr, e);
+				d->sumerr += e;
+				d->nerr++;
+			}
+		}
+	}
+}
+
+// Check the resampling paths, for each instruction set the CPU
+// supports or only for isa if it isn't negative, against the
+// reference on granule b. A path fails if its largest error exceeds
+// maxerr (physical units), more than a fraction maxfrac of its values
+// differ, or any fill value or NAN of the reference isn't one in it
+// or the other way around. Returns the number of failures.
+//
+static int
+check(Bench *b, int isa, double maxerr, double maxfrac)
+{
+	struct {
+		const char	*name;
+		Mat	*band;
+		double	scale, offset;
+	} bands[] = {
+		{"uint16", &b->band, b->scale, b->offset},
+		{"float", &b->band13, 1, 0},
+	};
+	int nfail = 0;
+
+	viirs_isa("auto");
+	int isa0 = isa >= 0 ? isa : ISA_GENERIC;
+	int isa1 = isa >= 0 ? isa : isa_current();
+	double npix = (double)b->width*b->height;
+	printf("	%-6s %-7s %-6s %-4s %10s %10s %9s %7s\n", "path", "isa", "band", "-g",
+		"maxerr", "meanerr", "ndiff", "nfill");
+	for(int k = 0; k < (int)nelem(bands); k++){
+		if(bands[k].band->empty())
+			continue;
+		for(int g = 0; g < 2; g++){
+			Mat ref = refband(b, *bands[k].band, bands[k].scale, bands[k].offset, g);
+			for(int i = isa0; i <= isa1; i++){
+				viirs_isa(isa_name(i));
+				for(int p = 0; p < (int)nelem(paths); p++){
+					Diff d;
+					Mat out = paths[p].fn(b, *bands[k].band, bands[k].scale, bands[k].offset, g);
+					diffband(out, ref, bands[k].scale, &d);
+					bool ok = d.maxerr <= maxerr && d.ndiff <= maxfrac*npix && d.nfill == 0;
+					printf("	%-6s %-7s %-6s %-4s %10.3g %10.3g %9.0f %7.0f %s\n", paths[p].name,
+						isa_name(i), bands[k].name, g ? "yes" : "no", d.maxerr,
+						d.nerr > 0 ? d.sumerr/d.nerr : 0, d.ndiff, d.nfill, ok ? "ok" : "FAIL");
+					nfail += !ok;
+				}
+			}
+		}
+	}
+	viirs_isa(isa >= 0 ? isa_name(isa) : "auto");
+	return nfail;
+}
+
+// Load the granule of band file h5file, with geolocation from
+// geofile, into b for -c.
+//
+static void
+loadgranule(Bench *b, const char *geofile, const char *h5file)
+{
+	Cbuf<float> lat, lon, bandf;
+	Cbuf<ushort> band;
+	uvlong dims[32], bdims[32];
+	float gain, offset;
+	char btstr[128];
+
+	int is = getbandname(h5file);
+	if(is < 1 || is > NBANDS){
+		eprintf("%s: not a VIIRS band file", h5file);
+	}
+	sprintf(btstr, "All_Data/VIIRS-M%i-SDR_All/%s", is, is < 12 ? "Reflectance" : "BrightnessTemperature");
+	if(readwrite_viirs_float(&lat.p, dims, geofile, "All_Data/VIIRS-MOD-GEO_All/Latitude", 0) != 0
+	|| readwrite_viirs_float(&lon.p, dims, geofile, "All_Data/VIIRS-MOD-GEO_All/Longitude", 0) != 0){
+		eprintf("%s: cannot read geolocation", geofile);
+	}
+	b->height = dims[0];
+	b->width = dims[1];
+	Mat(b->height, b->width, CV_32FC1, lat.p).copyTo(b->lat);
+	Mat(b->height, b->width, CV_32FC1, lon.p).copyTo(b->lon);
+	if(is != 13){
+		if(readwrite_viirs(&band.p, bdims, &gain, &offset, (char*)h5file, btstr, 0) != 0){
+			eprintf("%s: cannot read %s", h5file, btstr);
+		}
+		b->scale = gain;
+		b->offset = offset;
+	}else{
+		if(readwrite_viirs_float(&bandf.p, bdims, h5file, btstr, 0) != 0){
+			eprintf("%s: cannot read %s", h5file, btstr);
+		}
+		b->scale = 1;
+		b->offset = 0;
+	}
+	if(bdims[0] != dims[0] || bdims[1] != dims[1]){
+		eprintf("%s: band is %llux%llu; geolocation is %llux%llu", h5file, bdims[0], bdims[1], dims[0], dims[1]);
+	}
+	if(is != 13){
+		Mat(b->height, b->width, CV_16UC1, band.p).copyTo(b->band);
+	}else{
+		Mat(b->height, b->width, CV_32FC1, bandf.p).copyTo(b->band13);
+	}
+	getadjustedsortingind(b->sind, b->lat);
+}
+
+static double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+static void
+usage()
+{
+	printf("usage: %s [-n iterations] [-i isa] [rows...]\n", progname);
+	printf("       %s -c [-e maxerr] [-d maxfrac] [-i isa] [rows...] [-f GMODOfile bandfile]...\n", progname);
+	printf("\n");
+	printf("Time the resampling stages on synthetic granules with the given\n");
+	printf("number of rows (default: 768, one granule, and 5408, a ten minute\n");
+	printf("aggregate), reporting the best time of the iterations (default 5).\n");
+	printf("The kernels are run for instruction set isa, as with --isa of\n");
+	printf("viirsresam (default auto).\n");
+	printf("\n");
+	printf("With -c, check the staged and fused resampling, for every instruction\n");
+	printf("set the CPU supports (or only isa), against a reference implementation\n");
+	printf("in double precision, with and without -g, on the synthetic granules\n");
+	printf("(default: 768 rows) and on the band files given with -f. A check fails\n");
+	printf("if the largest error exceeds maxerr in physical units (default 0.01),\n");
+	printf("more than a fraction maxfrac of the values differ (default 0.001),\n");
+	printf("or the fill values differ. The exit status is 1 if any check fails.\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	vector<int> heights;
+	vector<const char*> files;
+	char *end;
+	int niter = 5;
+	int isa = -1;
+	bool docheck = false;
+	double maxerr = 0.01;
+	double maxfrac = 0.001;
+
+	progname = argv[0];
+	for(int i = 1; i < argc; i++){
+		if(strcmp(argv[i], "-n") == 0 && i+1 < argc){
+			niter = strtol(argv[++i], &end, 10);
+			if(*end != '\0' || niter < 1)
+				usage();
+		}else if(strcmp(argv[i], "-i") == 0 && i+1 < argc){
+			Status st = viirs_isa(argv[++i]);
+			if(st.code != STATUS_OK){
+				fprintf(stderr, "%s\n", st.msg);
+				exit(2);
+			}
+			isa = isa_current();
+		}else if(strcmp(argv[i], "-c") == 0){
+			docheck = true;
+		}else if(strcmp(argv[i], "-e") == 0 && i+1 < argc){
+			maxerr = strtod(argv[++i], &end);
+			if(*end != '\0' || maxerr < 0)
+				usage();
+		}else if(strcmp(argv[i], "-d") == 0 && i+1 < argc){
+			maxfrac = strtod(argv[++i], &end);
+			if(*end != '\0' || maxfrac < 0)
+				usage();
+		}else if(strcmp(argv[i], "-f") == 0 && i+2 < argc){
+			files.push_back(argv[++i]);
+			files.push_back(argv[++i]);
+		}else{
+			int h = strtol(argv[i], &end, 10);
+			if(*end != '\0' || h < 2*NDETECTORS || h%NDETECTORS != 0)
+				usage();
+			heights.push_back(h);
+		}
+	}
+	if(!files.empty() && !docheck)
+		usage();
+	if(heights.empty() && files.empty()){
+		heights.push_back(768);
+		if(!docheck)
+			heights.push_back(5408);
+	}
+
+	try{
+		if(docheck){
+			int nfail = 0;
+			for(int h = 0; h < (int)heights.size(); h++){
+				Bench b;
+				synthgranule(&b, heights[h]);
+				getadjustedsortingind(b.sind, b.lat);
+				printf("check synthetic granule %dx%d\n", b.height, b.width);
+				nfail += check(&b, isa, maxerr, maxfrac);
+			}
+			for(int f = 0; f < (int)files.size(); f += 2){
+				Bench b;
+				loadgranule(&b, files[f], files[f+1]);
+				printf("check %s %dx%d\n", files[f+1], b.height, b.width);
+				nfail += check(&b, isa, maxerr, maxfrac);
+			}
+			if(nfail > 0){
+				printf("%d checks FAILED\n", nfail);
+				return 1;
+			}
+			return 0;
+		}
+		for(int h = 0; h < (int)heights.size(); h++){
+			Bench b;
+
+			synthgranule(&b, heights[h]);
+			setup(&b);
+			double npix = (double)b.width*b.height;
+			printf("granule %dx%d, %s, best of %d\n", b.height, b.width,
+				isa_name(isa_current()), niter);
+			for(int i = 0; i < (int)nelem(stages); i++){
+				double best = 0;
+				for(int k = 0; k < niter; k++){
+					double t0 = now();
+					stages[i].fn(&b);
+					double t = now() - t0;
+					if(k == 0 || t < best)
+						best = t;
+				}
+				printf("	%-24s %9.2f ms %9.1f Mpixel/s\n", stages[i].name,
+					1e3*best, npix/best/1e6);
+			}
+		}
+	}catch(const std::exception &e){
+		fprintf(stderr, "%s\n", e.what());
+		exit(2);
+	}
+	return 0;
+}
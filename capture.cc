@@ -0,0 +1,215 @@
+//
+// Capture of resampling intermediates for diagnosing bad granules
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "viirsresam.h"
+
+static const char *capnames[NCAPS] = {
+	"before",
+	"lat",
+	"lon",
+	"sind",
+	"simg",
+	"slat",
+	"slon",
+	"res",
+	"after",
+	"ilon",
+	"final",
+	"tclat",
+	"tclon",
+	"tcslat",
+	"tcslon",
+	"tclatp",
+	"tclonp",
+};
+
+enum {
+	CAPQUEUE = 8,	// captures waiting to be written before capture blocks
+};
+
+// Intermediate waiting to be written.
+struct Cap {
+	char	path[1024];
+	int	what;
+	Mat	m;
+};
+
+uvlong capturemask;	// bit CAP_* set if capturing it; accessed atomically
+static const char *capturedir;
+static Queue *capq;
+static bool capclosed;	// by capture_flush; accessed atomically
+static pthread_t capthread;
+static __thread const char *capfile;	// file the thread is resampling, for naming captures
+
+// Name the captures made by this thread after file (a path) for
+// the scope. File may be NULL.
+CaptureScope::CaptureScope(const char *file)
+{
+	old = capfile;
+	capfile = file;
+}
+
+CaptureScope::~CaptureScope()
+{
+	capfile = old;
+}
+
+static void
+writecap(Cap *c)
+{
+	CaptureHdr h;
+
+	size_t n = c->m.total()*c->m.elemSize();
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CAPTURE_MAGIC, sizeof(h.magic));
+	h.rows = c->m.rows;
+	h.cols = c->m.cols;
+	h.type = c->m.type();
+	h.elemsize = c->m.elemSize();
+	snprintf(h.name, sizeof(h.name), "%s", capnames[c->what]);
+
+	int fd = open(c->path, O_RDWR|O_CREAT|O_TRUNC, 0666);
+	if(fd < 0){
+		fprintf(stderr, "capture: open %s failed: %s\n", c->path, strerror(errno));
+		return;
+	}
+	if(ftruncate(fd, sizeof(h) + n) != 0){
+		fprintf(stderr, "capture: write %s failed: %s\n", c->path, strerror(errno));
+		close(fd);
+		return;
+	}
+	char *p = (char*)mmap(NULL, sizeof(h) + n, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if(p == MAP_FAILED){
+		fprintf(stderr, "capture: mmap %s failed: %s\n", c->path, strerror(errno));
+		close(fd);
+		return;
+	}
+	memcpy(p, &h, sizeof(h));
+	memcpy(p + sizeof(h), c->m.data, n);
+	munmap(p, sizeof(h) + n);
+	close(fd);
+}
+
+static void*
+capproc(void *arg)
+{
+	Cap *c;
+
+	while((c = (Cap*)queue_get(capq)) != NULL){
+		writecap(c);
+		delete c;
+	}
+	return NULL;
+}
+
+// Queue a copy of intermediate m, of kind what, to be written by
+// the capture thread. Called by capture if what is being captured.
+void
+capture_put(int what, const Mat &m)
+{
+	const char *tag = "viirsresam";
+
+	if(__atomic_load_n(&capclosed, __ATOMIC_RELAXED)){
+		return;
+	}
+	if(capfile != NULL){
+		tag = strrchr(capfile, '/');
+		tag = tag != NULL ? tag+1 : capfile;
+	}
+	Cap *c = new Cap;
+	snprintf(c->path, sizeof(c->path), "%s/%s.%s.cap", capturedir, tag, capnames[what]);
+	c->what = what;
+	c->m = m.clone();
+	if(!queue_put(capq, c)){
+		// capture_flush closed the queue since capclosed was checked
+		delete c;
+	}
+}
+
+// Capture the intermediates named in the comma-separated list stages
+// (or "all") of every file resampled, writing each to a file
+// dir/file.stage.cap by a background thread. The file has a CaptureHdr
+// followed by the image rows. Must be called before resampling starts.
+//
+Status
+viirs_capture(const char *stages, const char *dir)
+{
+	Status st = {STATUS_OK, ""};
+	struct stat sb;
+	sigset_t all, old;
+	uvlong mask = 0;
+	char buf[256];
+
+	snprintf(buf, sizeof(buf), "%s", stages);
+	for(char *s = strtok(buf, ","); s != NULL; s = strtok(NULL, ",")){
+		int i;
+		if(strcmp(s, "all") == 0){
+			mask = (1ULL<<NCAPS) - 1;
+			continue;
+		}
+		for(i = 0; i < NCAPS; i++){
+			if(strcmp(s, capnames[i]) == 0)
+				break;
+		}
+		if(i == NCAPS){
+			st.code = STATUS_ERROR;
+			snprintf(st.msg, sizeof(st.msg), "unknown capture stage %s", s);
+			return st;
+		}
+		mask |= 1ULL<<i;
+	}
+	if(stat(dir, &sb) != 0 || !S_ISDIR(sb.st_mode)){
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "capture directory %s is not a directory", dir);
+		return st;
+	}
+	if(capq != NULL || mask == 0){
+		if(capq != NULL && !__atomic_load_n(&capclosed, __ATOMIC_RELAXED)){
+			capturedir = dir;
+			__atomic_store_n(&capturemask, mask, __ATOMIC_RELAXED);
+		}
+		return st;
+	}
+	capturedir = dir;
+	capq = queue_create(CAPQUEUE);
+
+	// like the I/O thread, the writer doesn't take the program's signals
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	int err = pthread_create(&capthread, NULL, capproc, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if(err != 0){
+		queue_free(capq);
+		capq = NULL;
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "cannot start capture thread: %s", strerror(err));
+		return st;
+	}
+	__atomic_store_n(&capturemask, mask, __ATOMIC_RELAXED);
+	return st;
+}
+
+// Stop capturing, and wait for the captures queued to be written.
+// Captures put afterwards, by threads still resampling, are dropped.
+// The queue is not freed, since other threads may be putting their
+// last capture in it while the program exits.
+void
+capture_flush()
+{
+	if(capq == NULL || __atomic_load_n(&capclosed, __ATOMIC_RELAXED)){
+		return;
+	}
+	__atomic_store_n(&capturemask, (uvlong)0, __ATOMIC_RELAXED);
+	__atomic_store_n(&capclosed, true, __ATOMIC_RELAXED);
+	queue_close(capq);
+	pthread_join(capthread, NULL);
+}
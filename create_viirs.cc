@@ -6,11 +6,13 @@
 #define TRUE	1
 #define FALSE	0
 
+hid_t h5open(const char *filename, unsigned flags);	// readwrite.cc
+
 // Write data in HDF5 file named filename with layer named varname.
 // The layout will be created if it doesn't exist already.
 //
-void
-create_viirs(Mat data, const char *filename, const char *varname)
+static void
+h5create_viirs(const Mat &data, const char *filename, const char *varname)
 {
 	hid_t dataset, dataspace, dtype;
 	
@@ -30,7 +32,7 @@ create_viirs(Mat data, const char *filename, const char *varname)
 	if(hdferr < 0){
 		eprintf("cannot initialize HDF5 library:");
 	}
-	hid_t file_id = H5Fopen(filename, H5F_ACC_RDWR, H5P_DEFAULT);
+	hid_t file_id = h5open(filename, H5F_ACC_RDWR);
 	if(file_id < 0){
 		eprintf("cannot open HDF5 file %s", filename);
 	}
@@ -91,8 +93,27 @@ create_viirs(Mat data, const char *filename, const char *varname)
 	if(hdferr < 0){
 		eprintf("cannot close HDF5 file %s", filename);
 	}
-	hdferr = H5close();
-	if(hdferr < 0){
-		eprintf("cannot close HDF5 library");
-	}
+}
+
+struct CreateReq {
+	const Mat	*data;
+	const char	*filename, *varname;
+};
+
+static void
+createreq(void *arg)
+{
+	CreateReq *r = (CreateReq*)arg;
+	Timer t(STAGE_H5WRITE);
+
+	h5create_viirs(*r->data, r->filename, r->varname);
+	report_bytes(0, (double)r->data->total()*r->data->elemSize());
+}
+
+// Same as h5create_viirs, run on the I/O thread.
+void
+create_viirs(Mat data, const char *filename, const char *varname)
+{
+	CreateReq r = {&data, filename, varname};
+	io_call(createreq, &r);
 }
@@ -0,0 +1,1627 @@
+//
+// Resampling of whole VIIRS granules and the library API
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "viirsresam.h"
+
+#define _LATNAME	"All_Data/VIIRS-MOD-GEO_All/Latitude"
+#define _LONNAME	"All_Data/VIIRS-MOD-GEO_All/Longitude"
+#define _TCLATNAME	"All_Data/VIIRS-MOD-GEO-TC_All/Latitude"
+#define _TCLONNAME	"All_Data/VIIRS-MOD-GEO-TC_All/Longitude"
+#define LATNAME _LATNAME
+#define LONNAME _LONNAME
+#define GEO_RESAM_ATTR_NAME	"Resampling"
+
+static const char*
+filebasename(const char *path)
+{
+	const char *p = strrchr(path, '/');
+	if(p == NULL){
+		return path;
+	}
+	return p+1;
+}
+
+// Type of file at path, given by its name.
+//
+int
+getfiletype(const char *path)
+{
+	const char *p = filebasename(path);
+	if(strlen(p) > 20 && strncmp(&p[20], "L2P_GHRSST", strlen("L2P_GHRSST")) == 0){
+		return L2P_GHRSST;
+	}
+	if(strncmp(p, "ACSPO_", strlen("ACSPO_")) == 0){
+		return ACSPO;
+	}
+	if(strncmp(p, "GMODO_npp_", strlen("GMODO_npp_")) == 0){
+		return GMODO;
+	}
+	if(strncmp(p, "GMTCO_npp_", strlen("GMTCO_npp_")) == 0){
+		return GMTCO;
+	}
+	return UNKNOWN;
+}
+
+static void
+writelatlon(const char *geofile, uvlong *dims, const Mat &slat, const Mat &slon, bool tc)
+{
+	int status;
+	
+	const char *latname = _LATNAME;
+	const char *lonname = _LONNAME;
+	if(tc){
+		latname = _TCLATNAME;
+		lonname = _TCLONNAME;
+	}
+	
+	// write sorted latitude & longitude
+	status = readwrite_viirs_float((float**)&slat.data, dims, geofile, latname, 1);
+	if(status != 0){
+		eprintf("Cannot read VIIRS (lat) geolocation data!");
+	}
+	status = readwrite_viirs_float((float**)&slon.data, dims, geofile, lonname, 1);
+	if(status != 0){
+		eprintf("Cannot read VIIRS (lon) geolocation data!\n");
+	}
+
+	// write resampling attribute for latitude & longitude
+	int estat = 0;
+	status = write_viirs_attribute(geofile, latname, GEO_RESAM_ATTR_NAME, 1.0);
+	if(status < 0){
+		printf("ERROR: Cannot write VIIRS attribute!\n");
+		estat = 2;
+	}
+	if(status > 0){
+		printf("WARNING! Data was already resampled\n");
+	}
+	status = write_viirs_attribute(geofile, lonname, GEO_RESAM_ATTR_NAME, 1.0);
+	if(status < 0){
+		printf("ERROR: Cannot write VIIRS attribute!\n");
+		estat = 2;
+	}
+	if(status > 0){
+		printf("WARNING! Data was already resampled\n");
+	}
+	if(estat != 0){
+		eprintf("Cannot write VIIRS resampling attribute to %s", geofile);
+	}
+}
+
+static void
+sortlatlon(const char *geofile)
+{
+	Mat sind;
+	int status;
+	uvlong dims[32];
+	Cbuf<float> latbuf, lonbuf;
+	
+	// read latitude & longitude
+	status = readwrite_viirs_float(&latbuf.p, dims, geofile, LATNAME, 0);
+	if(status != 0){
+		eprintf("Cannot read VIIRS (lat) geolocation data!");
+	}
+	status = readwrite_viirs_float(&lonbuf.p, dims, geofile, LONNAME, 0);
+	if(status != 0){
+		eprintf("Cannot read VIIRS (lon) geolocation data!");
+	}
+	int sy = dims[0];	// height, along the track
+	int sx = dims[1];	// width, across track, along scan line
+	Mat lat(sy, sx, CV_32FC1, latbuf.p);
+	Mat lon(sy, sx, CV_32FC1, lonbuf.p);
+
+	// sort latitude & longitude
+	getsortingind(sind, sy);
+	Mat slat = resample_sort(sind, lat);
+	Mat slon = resample_sort(sind, lon);
+	CHECKMAT(slat, CV_32FC1);
+	CHECKMAT(slon, CV_32FC1);
+	
+	writelatlon(geofile, dims, slat, slon, false);
+}
+
+/*
+static void
+run_ghrsst(char *ncfile, bool sortoutput)
+{
+	int ncid, n;
+	Mat _sst, lat, lon;
+	
+	n = nc_open(ncfile, NC_WRITE, &ncid);
+	if(n != NC_NOERR)
+		ncfatal(n, "nc_open failed for %s", ncfile);
+	
+	int varid = ghrsst_readwrite(ncid, "sea_surface_temperature", _sst, false);
+	float offset = ghrsst_readattr(ncid, varid, "add_offset");
+	float scale = ghrsst_readattr(ncid, varid, "scale_factor");
+	printf("scale = %f, offset = %f\n", scale, offset);
+	
+	CHECKMAT(_sst, CV_16SC1);
+	short *sst = (short*)_sst.data;
+	Mat _sstf = Mat::zeros(_sst.size(), CV_32FC1);
+	float *sstf = (float*)_sstf.data;
+	for(int i = 0; i < (int)_sst.total(); i++){
+		sstf[i] = sst[i]*scale + offset;
+	}
+	
+	ghrsst_readwrite(ncid, "lat", lat, false);
+	ghrsst_readwrite(ncid, "lon", lon, false);
+	resample_viirs_mat(_sstf, lat, lon, sortoutput, false);
+}
+*/
+
+// Reorder L2P GHRSST file ncfile. Run on the I/O thread as a whole,
+// because netCDF-4 is built on HDF5.
+//
+static void
+reorder_ghrsst(void *arg)
+{
+	const char *ncfile = (const char*)arg;
+	int ncid, n;
+	Mat sind, sst, m16, lat, lon, acspo;
+	
+	n = nc_open(ncfile, NC_WRITE, &ncid);
+	if(n != NC_NOERR)
+		ncfatal(n, "nc_open failed for %s", ncfile);
+	
+	try{
+		ghrsst_readwrite(ncid, "sea_surface_temperature", sst, false);
+		ghrsst_readwrite(ncid, "brightness_temperature_12um", m16, false);
+		ghrsst_readwrite(ncid, "lat", lat, false);
+		ghrsst_readwrite(ncid, "lon", lon, false);
+		ghrsst_readwrite(ncid, "l2p_flags", acspo, false);
+
+		CHECKMAT(sst, CV_16SC1);
+		CHECKMAT(m16, CV_16SC1);
+		CHECKMAT(lat, CV_32FC1);
+		CHECKMAT(lon, CV_32FC1);
+		CHECKMAT(acspo, CV_16SC1);
+
+		getadjustedsortingind(sind, lat);
+		Mat sst1 = resample_sort(sind, sst);
+		Mat m161 = resample_sort(sind, m16);
+		Mat lat1 = resample_sort(sind, lat);
+		Mat lon1 = resample_sort(sind, lon);
+		Mat acspo1 = resample_sort(sind, acspo);
+		
+		ghrsst_readwrite(ncid, "sea_surface_temperature", sst1, true);
+		ghrsst_readwrite(ncid, "brightness_temperature_12um", m161, true);
+		ghrsst_readwrite(ncid, "lat", lat1, true);
+		ghrsst_readwrite(ncid, "lon", lon1, true);
+		ghrsst_readwrite(ncid, "l2p_flags", acspo1, true);
+	}catch(...){
+		nc_close(ncid);
+		throw;
+	}
+
+	n = nc_close(ncid);
+	if(n != NC_NOERR)
+		ncfatal(n, "nc_close failed for %s", ncfile);
+}
+
+
+// Reorder ACSPO file ncfile, on the I/O thread like reorder_ghrsst.
+//
+static void
+reorder_acspo(void *arg)
+{
+	const char *ncfile = (const char*)arg;
+	int ncid, n;
+	Mat sind, sst, lat, lon, acspo;
+	
+	n = nc_open(ncfile, NC_WRITE, &ncid);
+	if(n != NC_NOERR)
+		ncfatal(n, "nc_open failed for %s", ncfile);
+	
+	try{
+		ghrsst_readwrite(ncid, "sst_regression", sst, false);
+		ghrsst_readwrite(ncid, "latitude", lat, false);
+		ghrsst_readwrite(ncid, "longitude", lon, false);
+		ghrsst_readwrite(ncid, "acspo_mask", acspo, false);
+		
+		CHECKMAT(sst, CV_32FC1);
+		CHECKMAT(lat, CV_32FC1);
+		CHECKMAT(lon, CV_32FC1);
+		CHECKMAT(acspo, CV_8UC1);
+		
+		getadjustedsortingind(sind, lat);
+		Mat sst1 = resample_sort(sind, sst);
+		Mat lat1 = resample_sort(sind, lat);
+		Mat lon1 = resample_sort(sind, lon);
+		Mat acspo1 = resample_sort(sind, acspo);
+		
+		
+		// write output
+		ghrsst_readwrite(ncid, "sst_regression", sst1, true);
+		ghrsst_readwrite(ncid, "latitude", lat1, true);
+		ghrsst_readwrite(ncid, "longitude", lon1, true);
+		ghrsst_readwrite(ncid, "acspo_mask", acspo1, true);
+	}catch(...){
+		nc_close(ncid);
+		throw;
+	}
+
+	n = nc_close(ncid);
+	if(n != NC_NOERR)
+		ncfatal(n, "nc_close failed for %s", ncfile);
+}
+
+// Sum of longitudes a1 and a2 given in degrees, wrapped into (-180, 180].
+// This is the same as adding the angles on the unit circle, without
+// needing any trigonometric functions. Either may be a fill value or
+// otherwise out of range, so the sum is reduced modulo 360.
+//
+static double
+lonsum(double a1, double a2)
+{
+	double sum = remainder(a1 + a2, 360.0);
+	if(sum == -180)
+		sum = 180;
+	return sum;
+}
+
+static void
+lonsummat(const Mat &_src1, const Mat &_src2, Mat &_dst)
+{
+	CHECKMAT(_src1, CV_32FC1);
+	CHECKMAT(_src2, CV_32FC1);
+	_dst = Mat::zeros(_src1.size(), CV_32FC1);
+	
+	float *src1 = (float*)_src1.data;
+	float *src2 = (float*)_src2.data;
+	float *dst = (float*)_dst.data;
+	
+	for(int i = 0; i < (int)_dst.total(); i++){
+		dst[i] = lonsum(src1[i], src2[i]);
+	}
+}
+
+// Rows *top and *bottom of the granules before and after in plan
+// that a file of width sx can be resampled with: those seam also has
+// the rows of. Seam may be NULL.
+static void
+seamrows(const GeoPlan *plan, const Seam *seam, int sx, int *top, int *bottom)
+{
+	*top = *bottom = 0;
+	if(seam == NULL){
+		return;
+	}
+	if(plan->top > 0 && !seam->top.empty() && seam->top[0].rows == plan->top && seam->top[0].cols == sx){
+		*top = plan->top;
+	}
+	if(plan->bottom > 0 && !seam->bottom.empty() && seam->bottom[0].rows == plan->bottom
+	&& seam->bottom[0].cols == sx){
+		*bottom = plan->bottom;
+	}
+}
+
+// Set lat and lon to the geolocation of plan with only top and bottom
+// rows of the granules before and after it, and sind to its sorting
+// indices, or to nothing if they must be computed for those rows.
+static void
+plangeo(const GeoPlan *plan, int top, int bottom, Mat &lat, Mat &lon, Mat &sind)
+{
+	if(top == plan->top && bottom == plan->bottom){
+		lat = plan->lat;
+		lon = plan->lon;
+		sind = plan->sind;
+		return;
+	}
+	Range r(plan->top - top, plan->lat.rows - plan->bottom + bottom);
+	lat = plan->lat.rowRange(r);
+	lon = plan->lon.rowRange(r);
+	sind.release();
+}
+
+// Write the spatial index of geolocation lat and lon of file
+// to file.idx.
+static void
+writeindex(const char *file, const Mat &lat, const Mat &lon)
+{
+	GeoIndex *idx;
+	char path[1024];
+
+	Status st = viirs_geoindex_build(lat, lon, &idx);
+	if(st.code != STATUS_OK){
+		eprintf("%s", st.msg);
+	}
+	snprintf(path, sizeof(path), "%s.idx", file);
+	st = viirs_geoindex_write(idx, path);
+	viirs_geoindex_free(idx);
+	if(st.code != STATUS_OK){
+		eprintf("%s", st.msg);
+	}
+}
+
+// Resample the terrain-corrected geolocation of gmtcofile, with the
+// geolocation read from gmodofile, or taken from plan if it's not NULL.
+// With a plan, the rows of the neighboring granules in seam are
+// resampled with it. With opts->index, the spatial index of the
+// resampled geolocation is written to gmtcofile.idx.
+//
+static void
+run_tcgeo(const char *gmodofile, const char *gmtcofile, const GeoPlan *plan, const Seam *seam,
+	const ResamOpts *opts)
+{
+	int status;
+	uvlong dims[32];
+	Cbuf<float> buflat, buflon, buftclat, buftclon;
+	Mat origlat, origlon, sind;
+	int top, bottom;
+	
+	if(plan == NULL){
+		status = readwrite_viirs_float(&buflat.p, dims, gmodofile, _LATNAME, 0);
+		if(status != 0){
+			eprintf("Cannot read VIIRS (lat) geolocation data!");
+		}
+		status = readwrite_viirs_float(&buflon.p, dims, gmodofile, _LONNAME, 0);
+		if(status != 0){
+			eprintf("Cannot read VIIRS (lon) geolocation data!");
+		}
+	}
+	status = readwrite_viirs_float(&buftclat.p, dims, gmtcofile, _TCLATNAME, 0);
+	if(status != 0){
+		eprintf("Cannot read VIIRS (lat) terrain-corrected geolocation data!");
+	}
+	status = readwrite_viirs_float(&buftclon.p, dims, gmtcofile, _TCLONNAME, 0);
+	if(status != 0){
+		eprintf("Cannot read VIIRS (lon) terrain-corrected geolocation data!");
+	}
+	report_count(COUNT_PIXELS, (double)dims[0]*dims[1]);
+	Mat tclat(dims[0], dims[1], CV_32FC1, buftclat.p);
+	Mat tclon(dims[0], dims[1], CV_32FC1, buftclon.p);
+	top = bottom = 0;
+	if(plan == NULL){
+		origlat = Mat(dims[0], dims[1], CV_32FC1, buflat.p);
+		origlon = Mat(dims[0], dims[1], CV_32FC1, buflon.p);
+	}else{
+		if(plan->lat.rows - plan->top - plan->bottom != (int)dims[0] || plan->lat.cols != (int)dims[1]){
+			eprintf("geolocation %s is %dx%d; terrain-corrected geolocation is %dx%d", plan->geofile,
+				plan->lat.rows - plan->top - plan->bottom, plan->lat.cols, (int)dims[0], (int)dims[1]);
+		}
+		seamrows(plan, seam, dims[1], &top, &bottom);
+		plangeo(plan, top, bottom, origlat, origlon, sind);
+		// replaced by the resampling below
+		origlat = origlat.clone();
+		origlon = origlon.clone();
+		if(top > 0 || bottom > 0){
+			vector<Mat> lats, lons;
+			if(top > 0){
+				lats.push_back(seam->top[0]);
+				lons.push_back(seam->top[1]);
+			}
+			lats.push_back(tclat);
+			lons.push_back(tclon);
+			if(bottom > 0){
+				lats.push_back(seam->bottom[0]);
+				lons.push_back(seam->bottom[1]);
+			}
+			vconcat(lats, tclat);
+			vconcat(lons, tclon);
+		}
+	}
+	capture(CAP_TCLAT, tclat);
+	capture(CAP_TCLON, tclon);
+	
+	Mat latdiff = tclat - origlat;
+	Mat londiff;
+	lonsummat(tclon, -origlon, londiff);
+	
+	if((capturing(CAP_TCSLAT) || capturing(CAP_TCSLON)) && opts->sortoutput){
+		// sort terrain-corrected latitude & longitude for debugging
+		Mat sind;
+		getadjustedsortingind(sind, origlat);
+		capture(CAP_TCSLAT, resample_sort(sind, tclat));
+		capture(CAP_TCSLON, resample_sort(sind, tclon));
+	}
+
+	printf("resampling lat & lon\n");
+	// origlat and origlon are replaced by the sorted latitude and
+	// interpolated longitude
+	vector<Mat> diffs;
+	diffs.push_back(latdiff);
+	diffs.push_back(londiff);
+	resample_viirs_mat(diffs, origlat, origlon, opts->sortoutput, false);
+	Mat tclatp = origlat + latdiff;
+	capture(CAP_TCLATP, tclatp);
+
+	Mat tclonp;
+	lonsummat(origlon, londiff, tclonp);
+	capture(CAP_TCLONP, tclonp);
+
+	// only the granule's own rows are written
+	Range own(top, top + dims[0]);
+	writelatlon(gmtcofile, dims, tclatp.rowRange(own), tclonp.rowRange(own), true);
+	if(opts->index){
+		writeindex(gmtcofile, tclatp.rowRange(own), tclonp.rowRange(own));
+	}
+}
+
+// Band number of a band file, given by the "SVMnn" in its name,
+// or 0 if there isn't one.
+//
+int
+getbandname(const char *h5file)
+{
+	int is = 0;
+	for(int i=(strlen(h5file)-6); i>=0; i--) {
+		// look for sequence "SVM", then following two chars give band number
+		if( (h5file[i]=='S') && (h5file[i+1]=='V') && (h5file[i+2]=='M') ) {
+			is = (h5file[i+3]-'0')*10 + (h5file[i+4]-'0');
+			break;
+		}
+	}
+	return is;
+}
+
+static bool
+inlonrange(float lon, float lonmin, float lonmax)
+{
+	if(lonmin <= lonmax){
+		return lonmin <= lon && lon <= lonmax;
+	}
+	return lon >= lonmin || lon <= lonmax;
+}
+
+// Same as isushortfill, without the branches of the switch so the
+// loops using it can be vectorized: the fill values are all those
+// from SOUB_UINT16_FILL up, except 65530.
+static ALWAYS_INLINE bool
+isushortfill_(ushort x)
+{
+	return (x >= SOUB_UINT16_FILL) & (x != SOUB_UINT16_FILL+2);
+}
+
+static ALWAYS_INLINE void
+band2phys16_(const ushort *band, int n, double scale, double offset, float *phys)
+{
+	for(int ix=0; ix<n; ix++) {
+		ushort val = band[ix];
+		if(isushortfill_(val)){
+			phys[ix] = NAN;
+		}else{
+			phys[ix] = scale*val + offset;
+		}
+	}
+}
+
+static ALWAYS_INLINE void
+band2phys32_(const float *band, int n, float *phys)
+{
+	for(int ix=0; ix<n; ix++) {
+		float val = band[ix];
+		if(isfloatfill(val)){
+			phys[ix] = NAN;
+		}else{
+			phys[ix] = val;
+		}
+	}
+}
+
+ISA_KERNEL(band2phys16, (const ushort *band, int n, double scale, double offset, float *phys),
+	(band, n, scale, offset, phys))
+ISA_KERNEL(band2phys32, (const float *band, int n, float *phys), (band, n, phys))
+
+// Convert n band values to physical values in phys, using NAN for
+// fill values.
+//
+void
+band2physbuf(const ushort *band, int n, double scale, double offset, float *phys)
+{
+	Timer t(STAGE_CONVERT);
+
+	band2phys16_isa[isa_current()](band, n, scale, offset, phys);
+}
+
+// Same as above for band M13, which needs no scaling.
+void
+band2physbuf(const float *band, int n, double scale, double offset, float *phys)
+{
+	Timer t(STAGE_CONVERT);
+
+	band2phys32_isa[isa_current()](band, n, phys);
+}
+
+// Whether the sorted band value raw is kept for the resampled physical
+// value v instead of requantizing v: fill values outside the deletion
+// zone, pixels that could not be resampled, and with gaponly the
+// valid pixels in kept order, which were not interpolated.
+static ALWAYS_INLINE bool
+keepraw16(float v, ushort raw, bool kept, bool gaponly)
+{
+	bool fill = isushortfill_(raw);
+
+	return (gaponly & kept & !fill) | (fill & (raw != DELETION_ZONE_INT)) | isnan(v);
+}
+
+// Scale resampled physical value v back to an integer value,
+// which may be out of the range of the band type.
+static ALWAYS_INLINE int
+requant16(float v, double scale, double offset)
+{
+	return (int) round((v - offset)/scale);
+}
+
+// Requantize row y of n pixels, with sorting indices sind. The clamped
+// values are only counted, so that the loop can be vectorized.
+static ALWAYS_INLINE void
+phys2band16_(const float *phys, const ushort *simg, const int *sind, int y, int n,
+	double scale, double offset, bool gaponly, ushort *band, int *nbowtie, int *nclamped)
+{
+	int nb = 0, nc = 0;
+
+	for(int x = 0; x < n; x++){
+		ushort raw = simg[x];
+		bool req = !keepraw16(phys[x], raw, sind[x] == y, gaponly);
+		int j = requant16(phys[x], scale, offset);
+		nb += req & (raw == DELETION_ZONE_INT);
+		nc += req & ((j < 0) | (j > 65535));
+		j = j < 0 ? 0 : j > 65535 ? 65535 : j;
+		band[x] = req ? (ushort) j : raw;
+	}
+	*nbowtie = nb;
+	*nclamped = nc;
+}
+
+ISA_KERNEL(phys2band16, (const float *phys, const ushort *simg, const int *sind, int y, int n,
+	double scale, double offset, bool gaponly, ushort *band, int *nbowtie, int *nclamped),
+	(phys, simg, sind, y, n, scale, offset, gaponly, band, nbowtie, nclamped))
+
+// Convert the sx*sy resampled physical values in phys back to band
+// values in band. Simg is the sorted band image with sorting indices
+// sind, which gives the fill values to keep, and with gaponly the
+// values that were not interpolated.
+//
+void
+phys2bandbuf(const float *phys, const ushort *simg, const Mat &sind, int sx, int sy,
+	double scale, double offset, bool gaponly, ushort *band)
+{
+	Timer t(STAGE_REQUANT);
+	int nbowtie, nclamped, nb, nc;
+
+	nbowtie = nclamped = 0;
+	for(int y = 0; y < sy; y++){
+		int o = y*sx;
+		const int *sindrow = sind.ptr<int>(y);
+		phys2band16_isa[isa_current()](&phys[o], &simg[o], sindrow, y, sx, scale, offset,
+			gaponly, &band[o], &nb, &nc);
+		nbowtie += nb;
+		nclamped += nc;
+		if(nc == 0)
+			continue;
+
+		// report the values out of range in the row
+		for(int x = 0; x < sx; x++){
+			if(keepraw16(phys[o+x], simg[o+x], sindrow[x] == y, gaponly))
+				continue;
+			int j = requant16(phys[o+x], scale, offset);
+			if(j < 0 || j > 65535){
+				printf("Output data out of range at ( %5i %5i ): %i\n", x, y, j);
+			}
+		}
+	}
+	report_count(COUNT_BOWTIE, nbowtie);
+	report_count(COUNT_CLAMPED, nclamped);
+}
+
+static ALWAYS_INLINE void
+phys2band32_(const float *phys, const float *simg, int n, float *band, int *nbowtie)
+{
+	int nb = 0;
+
+	for(int ix=0; ix<n; ix++) {
+		if((isfloatfill(simg[ix]) && simg[ix] != DELETION_ZONE_FLOAT) || isnan(phys[ix])){
+			band[ix] = simg[ix];
+		}else{
+			nb += simg[ix] == DELETION_ZONE_FLOAT;
+			band[ix] = phys[ix];
+		}
+	}
+	*nbowtie = nb;
+}
+
+ISA_KERNEL(phys2band32, (const float *phys, const float *simg, int n, float *band, int *nbowtie),
+	(phys, simg, n, band, nbowtie))
+
+// Same as above for band M13, with no conversion.
+void
+phys2bandbuf(const float *phys, const float *simg, const Mat &sind, int sx, int sy,
+	double scale, double offset, bool gaponly, float *band)
+{
+	Timer t(STAGE_REQUANT);
+	int nbowtie;
+
+	phys2band32_isa[isa_current()](phys, simg, sx*sy, band, &nbowtie);
+	report_count(COUNT_BOWTIE, nbowtie);
+}
+
+// Resample band image in buffer1 (or bufferf1 for band M13) in place,
+// going through full-size intermediate images. Bufferf2 and bufferf3 are
+// the latitude and longitude. The sorted band image is returned in
+// _simg (or _simgf for band M13). If gaponly is set, only reordered
+// and fill pixels are interpolated; the others are left as they are.
+// If glat and glon are not NULL, they are set to the geolocation of
+// the resampled image.
+// The intermediates stay float: as half precision floats they would
+// be off by up to 0.25 K on M15, a hundred quantization steps, and
+// resampling them measured no faster, being bound by the weights.
+//
+static void
+resample_band_staged(int is, ushort *buffer1, float *bufferf1, const float *bufferf2, const float *bufferf3,
+	int sx, int sy, double scale, double offset, const Mat &sind, bool sortoutput, bool gaponly,
+	Mat &_simg, Mat &_simgf, Mat *glat, Mat *glon)
+{
+	float ** img_in, **lat, **lon;
+
+	// allocate temporary data arrays
+	img_in = alloc2d<float>(sy, sx);
+	lat = alloc2d<float>(sy, sx);
+	lon = alloc2d<float>(sy, sx);
+	if(img_in == NULL || lat == NULL || lon == NULL) {
+		free2d(img_in);
+		free2d(lat);
+		free2d(lon);
+		eprintf("ERROR: Cannot allocate memory");
+	}
+
+	// if needed, apply scale and offset to get physical data
+	if(is!=13) {
+		band2physbuf(buffer1, sx*sy, scale, offset, img_in[0]);
+	} else {
+		// no scaling for band 13
+		band2physbuf(bufferf1, sx*sy, scale, offset, img_in[0]);
+	}
+
+	// copy geolocation arrays
+	for(int ix=0; ix<sx*sy; ix++) {
+		lat[0][ix] = bufferf2[ix];
+	}
+	for(int ix=0; ix<sx*sy; ix++) {
+		lon[0][ix] = bufferf3[ix];
+	}
+
+	ushort *simg = NULL;
+	float *simgf = NULL;
+
+	// resampling of image on sorted lon, lat grid
+	try{
+		if(is != 13){
+			resample_viirs(img_in, lat, lon, sx, sy, sortoutput, gaponly);
+
+			Mat _img_in(sy, sx, CV_16UC1, buffer1);
+			_simg = resample_sort(sind, _img_in);
+			CHECKMAT(_simg, CV_16UC1);
+			simg = (ushort*)_simg.data;
+		}else{
+			resample_viirs(img_in, lat, lon, sx, sy, sortoutput, gaponly);
+
+			Mat _img_in(sy, sx, CV_32FC1, bufferf1);
+			_simgf = resample_sort(sind, _img_in);
+			CHECKMAT(_simgf, CV_32FC1);
+			simgf = (float*)_simgf.data;
+		}
+	}catch(...){
+		free2d(img_in);
+		free2d(lat);
+		free2d(lon);
+		throw;
+	}
+	
+
+	// Scale resampled data back to integers if band != M13
+	if(is!=13) {
+		phys2bandbuf(img_in[0], simg, sind, sx, sy, scale, offset, gaponly, buffer1);
+	} else {
+		// no conversion for band M13
+		phys2bandbuf(img_in[0], simgf, sind, sx, sy, scale, offset, gaponly, bufferf1);
+	}
+	if(glat != NULL){
+		*glat = Mat(sy, sx, CV_32FC1, lat[0]).clone();
+		*glon = Mat(sy, sx, CV_32FC1, lon[0]).clone();
+	}
+
+	free2d(img_in);
+	free2d(lat);
+	free2d(lon);
+}
+
+// Read the geolocation in geofile and compute its sorting indices.
+//
+static void
+readgeoplan(const char *geofile, GeoPlan *plan)
+{
+	uvlong dims[32];
+	Cbuf<float> lat, lon;
+
+	if(readwrite_viirs_float(&lat.p, dims, geofile, LATNAME, 0) != 0){
+		eprintf("Cannot read VIIRS (lat) geolocation data!");
+	}
+	if(readwrite_viirs_float(&lon.p, dims, geofile, LONNAME, 0) != 0){
+		eprintf("Cannot read VIIRS (lon) geolocation data!");
+	}
+	Mat(dims[0], dims[1], CV_32FC1, lat.p).copyTo(plan->lat);
+	Mat(dims[0], dims[1], CV_32FC1, lon.p).copyTo(plan->lon);
+	getadjustedsortingind(plan->sind, plan->lat);
+	plan->top = plan->bottom = 0;
+	snprintf(plan->geofile, sizeof(plan->geofile), "%s", geofile);
+}
+
+static void
+seterror(Status *st, const char *msg)
+{
+	st->code = STATUS_ERROR;
+	snprintf(st->msg, sizeof(st->msg), "%s", msg);
+}
+
+// Set field to the name of the field of band is (1 to NBANDS)
+// holding its resampling attribute, and name to the attribute name.
+static void
+bandattr(int is, char *field, char *name)
+{
+	sprintf(field, "Data_Products/VIIRS-M%i-SDR/VIIRS-M%i-SDR_Aggr", is, is);
+	if(is<12) {
+		sprintf(name, "ResamplingReflectance");
+	} else {
+		sprintf(name, "ResamplingBrightnessTemperature");
+	}
+}
+
+// Whether file is to be skipped because it was already resampled,
+// unless opts->force is set.
+static bool
+skipfile(const char *file, const ResamOpts *opts)
+{
+	bool done;
+
+	if(opts->force){
+		return false;
+	}
+	Status st = viirs_resampled(file, &done);
+	if(st.code != STATUS_OK){
+		eprintf("%s", st.msg);
+	}
+	if(done){
+		printf("%s was already resampled; skipped\n", file);
+	}
+	return done;
+}
+
+// Band file being resampled, passed between the read, compute
+// and write stages of run_band.
+struct BandJob {
+	char	h5file[1024];
+	char	geofile[1024];
+	const GeoPlan	*plan;
+	Seam	seam;	// rows of the neighboring granules, used with plan
+	ResamOpts	opts;
+	int	is;	// band number
+	char	attrfieldstr[128], attrnamestr[128], btstr[128], reorderstr[128], attrrowsstr[160];
+	int	row0, nrows, wrow0, wnrows;
+	int	top, bottom;	// rows of the neighboring granules stacked around the band's own
+	int	sx, sy;
+	uvlong	dims1[32];
+	float	scale1, offset1;
+	Cbuf<ushort>	buffer1;	// band data, or bufferf1 for band M13
+	Cbuf<float>	bufferf1, bufferf2, bufferf3;
+	Mat	sind, origlat, origlon;
+	Mat	_simg, _simgf;	// reordered band data, for opts.extra
+	Grid	grid;	// gridded band data, for opts.gridres
+	Report	report;
+	Status	st;	// status of the last stage run, for the report
+};
+
+// Band values raw of scaling scale and offset, converted to scaling
+// toscale and tooffset. Fill values are kept.
+static Mat
+rescaled(const Mat &raw, float scale, float offset, float toscale, float tooffset)
+{
+	if(scale == toscale && offset == tooffset){
+		return raw;
+	}
+	Mat m = raw.clone();
+	for(int y = 0; y < m.rows; y++){
+		ushort *p = m.ptr<ushort>(y);
+		for(int x = 0; x < m.cols; x++){
+			if(isushortfill_(p[x]))
+				continue;
+			int j = (int) round((scale*p[x] + offset - tooffset)/toscale);
+			p[x] = j < 0 ? 0 : j >= SOUB_UINT16_FILL ? SOUB_UINT16_FILL-1 : j;
+		}
+	}
+	return m;
+}
+
+// Replace buffer *buf of sy rows of n bytes by one with the rows of
+// top above them and those of bottom below them.
+static void
+stackrows(void **buf, int sy, size_t n, const Mat &top, const Mat &bottom)
+{
+	char *p = (char*)plane_alloc((top.rows + sy + bottom.rows)*n);
+	if(p == NULL){
+		eprintf("ERROR: Cannot allocate memory");
+	}
+	memcpy(p, top.data, top.rows*n);
+	memcpy(p + top.rows*n, *buf, sy*n);
+	memcpy(p + (top.rows + sy)*n, bottom.data, bottom.rows*n);
+	plane_free(*buf);
+	*buf = p;
+}
+
+// Stack the job->top and job->bottom rows of the neighboring granules
+// in job->seam around the band data of job, in the band's scaling.
+static void
+stackseam(BandJob *job)
+{
+	const Seam *seam = &job->seam;
+	Mat top, bottom;
+
+	if(job->is != 13){
+		if(job->top > 0)
+			top = rescaled(seam->top[0], seam->scale[0], seam->offset[0], job->scale1, job->offset1);
+		if(job->bottom > 0)
+			bottom = rescaled(seam->bottom[0], seam->scale[1], seam->offset[1], job->scale1, job->offset1);
+		stackrows((void**)&job->buffer1.p, job->sy, job->sx*sizeof(ushort), top, bottom);
+	}else{
+		if(job->top > 0)
+			top = seam->top[0];
+		if(job->bottom > 0)
+			bottom = seam->bottom[0];
+		stackrows((void**)&job->bufferf1.p, job->sy, job->sx*sizeof(float), top, bottom);
+	}
+}
+
+// Find the rows of the granule selected by job->opts.region, once per
+// job. Rows [wrow0, wrow0+wnrows) are resampled and written back.
+// Rows [row0, row0+nrows) are read, which includes two more scans
+// on each side if available. The inner one is needed by the resampling
+// stencil, and the outer one makes the inner one sorted the same way
+// as in the whole granule. The rows are extended to whole scans. The
+// whole granule is used if there's no region, and nrows is left 0.
+// With a bounding box, the whole geolocation is needed to find the
+// rows within the box; it's kept in bufferf2 and bufferf3 for readband.
+//
+static void
+jobrows(BandJob *job)
+{
+	const Region *region = job->opts.region;
+	const char *geofile = job->geofile;
+	uvlong dims[32];
+	int height, r0, r1;
+
+	if(region == NULL || job->wnrows > 0){
+		return;
+	}
+	if(viirs_dimsizes(geofile, LATNAME, dims) != 0){
+		eprintf("Cannot read VIIRS (lat) geolocation dimensions!");
+	}
+	height = dims[0];
+
+	if(region->bbox){
+		if(readwrite_viirs_float(&job->bufferf2.p, dims, geofile, LATNAME, 0) != 0){
+			eprintf("Cannot read VIIRS (lat) geolocation data!");
+		}
+		if(readwrite_viirs_float(&job->bufferf3.p, dims, geofile, LONNAME, 0) != 0){
+			eprintf("Cannot read VIIRS (lon) geolocation data!");
+		}
+		const float *lat = job->bufferf2.p;
+		const float *lon = job->bufferf3.p;
+		int width = dims[1];
+		r0 = height;
+		r1 = 0;
+		for(int y = 0; y < height; y++){
+			for(int x = 0; x < width; x++){
+				float la = lat[y*width + x];
+				float lo = lon[y*width + x];
+				if(region->latmin <= la && la <= region->latmax
+				&& inlonrange(lo, region->lonmin, region->lonmax)){
+					if(y < r0)
+						r0 = y;
+					r1 = y+1;
+					break;
+				}
+			}
+		}
+		if(r0 >= r1){
+			eprintf("no pixels within bounding box %g:%g:%g:%g",
+				region->latmin, region->latmax, region->lonmin, region->lonmax);
+		}
+	}else{
+		r0 = region->row0;
+		r1 = region->row1;
+	}
+
+	// extend to whole scans
+	r0 = MAX(0, r0 - r0%NDETECTORS);
+	r1 = MIN(height, r1 + (NDETECTORS - r1%NDETECTORS)%NDETECTORS);
+	if(r0 >= r1){
+		eprintf("invalid rows %d:%d for granule with %d rows", r0, r1, height);
+	}
+	job->wrow0 = r0;
+	job->wnrows = r1 - r0;
+	job->row0 = MAX(0, r0 - 2*NDETECTORS);
+	job->nrows = MIN(height, r1 + 2*NDETECTORS) - job->row0;
+}
+
+// Read the band data of job, and the geolocation unless it's taken
+// from job->plan.
+//
+static void
+readband(BandJob *job)
+{
+	ReportScope rs(&job->report);
+	const Region *region = job->opts.region;
+	const char *h5file = job->h5file;
+	const char *geofile = job->geofile;
+	int status, is;
+
+	if(region != NULL && job->opts.extra){
+		eprintf("reordered band data cannot be saved when resampling part of a granule");
+	}
+
+	// extract the name of band from the file
+	is = job->is = getbandname(h5file);
+	if(is < 1 || is > NBANDS) {
+		eprintf("ERROR: Invalid band %d", is);
+	}
+	printf("Band = %i\n", is);
+
+	// generate resampling attribute field name
+	// and the names of the corresponding resampling attributes
+	// and the names of main data fields to be resampled
+	bandattr(is, job->attrfieldstr, job->attrnamestr);
+	if(is<12) {
+		// for M11 and below, resample Reflectance
+		sprintf(job->btstr, "All_Data/VIIRS-M%i-SDR_All/Reflectance", is);
+		sprintf(job->reorderstr, "All_Data/VIIRS-M%i-SDR_All/ReorderedReflectance", is);
+	} else {
+		// for M12 and above, resample Brightness Temperature
+		sprintf(job->btstr, "All_Data/VIIRS-M%i-SDR_All/BrightnessTemperature", is);
+		sprintf(job->reorderstr, "All_Data/VIIRS-M%i-SDR_All/ReorderedBrightnessTemperature", is);
+	}
+	printf("Resampling atribute location = %s\n", job->attrfieldstr);
+	printf("Resampling atribute name = %s\n", job->attrnamestr);
+	printf("Data location = %s\n", job->btstr);          // name of main data field to be resampled
+	sprintf(job->attrrowsstr, "%sRows", job->attrnamestr);
+
+	jobrows(job);
+	if(region != NULL){
+		printf("Resampling rows %d-%d\n", job->wrow0, job->wrow0+job->wnrows);
+	}
+
+	// read band data
+	if(is!=13) {
+		status = readwrite_viirs_rows(&job->buffer1.p, job->dims1, &job->scale1, &job->offset1,
+			h5file, job->btstr, 0, job->row0, job->nrows);
+	} else {
+		status = readwrite_viirs_float_rows(&job->bufferf1.p, job->dims1,
+			h5file, job->btstr, 0, job->row0, job->nrows);
+	}
+	if(status!=0) {
+		eprintf("ERROR: Cannot read VIIRS data!");
+	}
+
+	// extract dimensions info
+	int sy = job->sy = job->nrows > 0 ? job->nrows : (int)job->dims1[0]; // height, along the track
+	int sx = job->sx = job->dims1[1]; // width, across track, along scan line
+	printf("nx = %i ny = %i\n", sx, sy);
+
+	const GeoPlan *plan = job->plan;
+	if(plan != NULL && region == NULL){
+		if(plan->lat.rows - plan->top - plan->bottom != sy || plan->lat.cols != sx){
+			eprintf("geolocation %s is %dx%d; band is %dx%d", plan->geofile,
+				plan->lat.rows - plan->top - plan->bottom, plan->lat.cols, sy, sx);
+		}
+		seamrows(plan, &job->seam, sx, &job->top, &job->bottom);
+		if(job->top > 0 || job->bottom > 0){
+			stackseam(job);
+			job->row0 = -job->top;
+			sy = job->sy = job->top + sy + job->bottom;
+		}
+		plangeo(plan, job->top, job->bottom, job->origlat, job->origlon, job->sind);
+	}else if(job->bufferf2.p != NULL){
+		// whole geolocation already read by jobrows
+		job->origlat = Mat(sy, sx, CV_32FC1, job->bufferf2.p + (size_t)job->row0*sx);
+		job->origlon = Mat(sy, sx, CV_32FC1, job->bufferf3.p + (size_t)job->row0*sx);
+	}else{
+		// read geolocation data
+		uvlong dims[32];
+		status = readwrite_viirs_float_rows( &job->bufferf2.p, dims, geofile, LATNAME, 0, job->row0, job->nrows);
+		if(status!=0) {
+			eprintf("Cannot read VIIRS (lat) geolocation data!");
+		}
+		status = readwrite_viirs_float_rows( &job->bufferf3.p, dims, geofile, LONNAME, 0, job->row0, job->nrows);
+		if(status!=0) {
+			eprintf("Cannot read VIIRS (lon) geolocation data!\n");
+		}
+		job->origlat = Mat(sy, sx, CV_32FC1, job->bufferf2.p);
+		job->origlon = Mat(sy, sx, CV_32FC1, job->bufferf3.p);
+	}
+}
+
+// Grid the resampled band data of job, only its own rows, with
+// geolocation lat and lon of the resampled pixels.
+//
+static void
+gridband(BandJob *job, double scale, double offset, const Mat &lat, const Mat &lon)
+{
+	Timer t(STAGE_GRID);
+	Mat img;
+
+	if(job->is != 13){
+		img = Mat(job->sy, job->sx, CV_16UC1, job->buffer1.p);
+	}else{
+		img = Mat(job->sy, job->sx, CV_32FC1, job->bufferf1.p);
+	}
+	int y0 = job->wrow0 - job->row0;
+	Range own(y0, y0 + (job->wnrows > 0 ? job->wnrows : job->sy - job->top - job->bottom));
+	grid_band(img.rowRange(own), scale, offset, lat.rowRange(own), lon.rowRange(own),
+		job->opts.gridres, job->opts.gridthreads, &job->grid);
+}
+
+// Resample the band data of job in memory.
+//
+static void
+computeband(BandJob *job)
+{
+	ReportScope rs(&job->report);
+	CaptureScope cs(job->h5file);
+	const ResamOpts *opts = &job->opts;
+	int is = job->is;
+	int sx = job->sx;
+	int sy = job->sy;
+	double scale, offset;
+	Mat glat, glon;
+
+	if(job->sind.empty()){
+		getadjustedsortingind(job->sind, job->origlat);
+	}
+	report_count(COUNT_PIXELS, (double)sx*(job->wnrows > 0 ? job->wnrows : sy - job->top - job->bottom));
+
+	// extract scale and offset
+	scale = 1;
+	offset = 0;
+	if(is!=13) {
+		scale  = ((double) job->scale1);
+		offset = ((double) job->offset1);
+		printf("scale = %f offset = %f\n", scale, offset);
+	}
+
+	if(opts->fused){
+		// sort, resample and requantize in a single pass
+		if(is != 13){
+			Mat img(sy, sx, CV_16UC1, job->buffer1.p);
+			resample_band_fused(job->sind, img, job->origlat, job->origlon, scale, offset,
+				opts->gaponly, opts->extra ? &job->_simg : NULL,
+				opts->gridres > 0 ? &glat : NULL, opts->gridres > 0 ? &glon : NULL);
+		}else{
+			Mat img(sy, sx, CV_32FC1, job->bufferf1.p);
+			resample_band_fused(job->sind, img, job->origlat, job->origlon, scale, offset,
+				opts->gaponly, opts->extra ? &job->_simgf : NULL,
+				opts->gridres > 0 ? &glat : NULL, opts->gridres > 0 ? &glon : NULL);
+		}
+	}else{
+		resample_band_staged(is, job->buffer1.p, job->bufferf1.p,
+			job->origlat.ptr<float>(0), job->origlon.ptr<float>(0), sx, sy,
+			scale, offset, job->sind, opts->sortoutput, opts->gaponly,
+			job->_simg, job->_simgf,
+			opts->gridres > 0 ? &glat : NULL, opts->gridres > 0 ? &glon : NULL);
+	}
+	if(opts->gridres > 0){
+		gridband(job, scale, offset, glat, glon);
+	}
+}
+
+// Write the resampled band data of job and the resampling attributes
+// back to the band file.
+//
+static void
+writeband(BandJob *job)
+{
+	ReportScope rs(&job->report);
+	const char *h5file = job->h5file;
+	int status;
+
+	if(job->is!=13) {
+		// write resampled data back to file as short int
+		ushort *wbuf = job->buffer1.p + (job->wrow0-job->row0)*job->sx;
+		status = readwrite_viirs_rows(&wbuf, job->dims1, &job->scale1, &job->offset1,
+			h5file, job->btstr, 1, job->wrow0, job->wnrows);
+	} else {
+		// write resampled band M13 data back to file as float
+		float *wbuf = job->bufferf1.p + (job->wrow0-job->row0)*job->sx;
+		status = readwrite_viirs_float_rows(&wbuf, job->dims1, h5file, job->btstr, 1, job->wrow0, job->wnrows);
+	}
+	if(status!=0) {
+		eprintf("ERROR: Cannot write VIIRS data!");
+	}
+
+	// Write a resampled attribute. Part of a granule is only recorded in
+	// the rows attribute, so the file isn't taken as resampled; a whole
+	// granule makes the rows recorded by earlier runs meaningless.
+	if(job->opts.region != NULL){
+		status = write_viirs_attribute_rows(h5file, job->attrfieldstr, job->attrrowsstr,
+			job->wrow0, job->wrow0+job->wnrows);
+	}else{
+		status = write_viirs_attribute(h5file, job->attrfieldstr, job->attrnamestr, 1.0);
+		if(status >= 0 && delete_viirs_attribute(h5file, job->attrfieldstr, job->attrrowsstr) < 0){
+			status = -1;
+		}
+	}
+	if(status < 0){
+		eprintf("ERROR: Cannot write VIIRS attribute!\n");
+	}
+	if(status > 0){
+		printf("WARNING! Data was already resampled\n");
+	}
+	
+	if(job->opts.extra){
+		Range own(job->top, job->sy - job->bottom);
+		if(job->is != 13){
+			create_viirs(job->_simg.rowRange(own), h5file, job->reorderstr);
+		}else{
+			create_viirs(job->_simgf.rowRange(own), h5file, job->reorderstr);
+		}
+	}
+	if(job->opts.gridres > 0){
+		char path[sizeof(job->h5file)+8];
+		snprintf(path, sizeof(path), "%s.grid", h5file);
+		grid_write(&job->grid, path, strrchr(job->btstr, '/')+1);
+	}
+}
+
+// Whether the band file of job is to be skipped because the rows it
+// would resample were already resampled, unless opts->force is set.
+// A file resampled in part, with --rows or --bbox, only has the rows
+// resampled recorded in its rows attribute. If some of the rows are
+// recorded and others aren't, the file is refused: resampling rows
+// twice corrupts them, and the others alone would be resampled with
+// the rows around them already resampled.
+static bool
+skipband(BandJob *job)
+{
+	const char *file = job->h5file;
+	char field[128], name[128], rowsname[160];
+	vector<int> extents;
+	int r0, r1, ndone;
+
+	if(job->opts.force){
+		return false;
+	}
+	if(skipfile(file, &job->opts)){
+		return true;
+	}
+	int is = getbandname(file);
+	if(is < 1 || is > NBANDS){
+		return false;
+	}
+	bandattr(is, field, name);
+	snprintf(rowsname, sizeof(rowsname), "%sRows", name);
+	int n = read_viirs_attribute_rows(file, field, rowsname, extents);
+	if(n < 0){
+		eprintf("cannot read resampling attribute %s of %s", rowsname, file);
+	}
+	if(n == 0){
+		return false;
+	}
+	if(job->opts.region != NULL){
+		jobrows(job);
+		r0 = job->wrow0;
+		r1 = job->wrow0 + job->wnrows;
+	}else{
+		uvlong dims[32];
+		if(viirs_dimsizes(job->geofile, LATNAME, dims) != 0){
+			eprintf("Cannot read VIIRS (lat) geolocation dimensions!");
+		}
+		r0 = 0;
+		r1 = dims[0];
+	}
+	ndone = 0;
+	for(size_t i = 0; i+1 < extents.size(); i += 2){
+		ndone += MAX(0, MIN(r1, extents[i+1]) - MAX(r0, extents[i]));
+	}
+	if(ndone == r1 - r0){
+		printf("rows %d-%d of %s were already resampled; skipped\n", r0, r1, file);
+		return true;
+	}
+	if(ndone > 0){
+		eprintf("%d of rows %d-%d of %s were already resampled by --rows or --bbox; "
+			"resample the file from the original, or use -F", ndone, r0, r1, file);
+	}
+	return false;
+}
+
+static BandJob*
+newbandjob(const char *h5file, const char *geofile, const GeoPlan *plan, const Seam *seam,
+	const ResamOpts *opts)
+{
+	BandJob *job = new BandJob;
+	Status st = {STATUS_OK, ""};
+
+	snprintf(job->h5file, sizeof(job->h5file), "%s", h5file);
+	snprintf(job->geofile, sizeof(job->geofile), "%s", geofile);
+	job->plan = plan;
+	if(seam != NULL){
+		job->seam = *seam;
+	}
+	job->row0 = job->nrows = 0;
+	job->wrow0 = job->wnrows = 0;
+	job->top = job->bottom = 0;
+	job->opts = *opts;
+	report_init(&job->report);
+	job->st = st;
+	return job;
+}
+
+// Free job, after ending its report.
+static void
+freebandjob(BandJob *job)
+{
+	report_end(job->opts.report, &job->report, job->geofile, job->h5file, &job->st);
+	delete job;
+}
+
+// Resample band file h5file with geolocation file geofile.
+// If opts->region is not NULL, only the scans covering it are resampled.
+// Otherwise, the geolocation and sorting indices are taken from plan
+// if it's not NULL, instead of being read from geofile.
+// Returns false if the file was skipped because it was already resampled.
+//
+static bool
+run_band(const char *h5file, const char *geofile, const GeoPlan *plan, const ResamOpts *opts)
+{
+	BandJob *job = newbandjob(h5file, geofile, plan, NULL, opts);
+	bool skip;
+
+	try{
+		skip = skipband(job);
+		if(!skip){
+			readband(job);
+			computeband(job);
+			writeband(job);
+		}
+	}catch(const std::exception &e){
+		seterror(&job->st, e.what());
+		freebandjob(job);
+		throw;
+	}
+	job->st.skipped = skip;
+	freebandjob(job);
+	return !skip;
+}
+
+// Set opts to the default options: the whole granule is resampled
+// the same way as the viirsresam program without flags.
+void
+resamopts_init(ResamOpts *opts)
+{
+	memset(opts, 0, sizeof(*opts));
+	// We no longer can undo sorting because adjusting breaking points
+	// makes "sorting" not be a permutation.
+	opts->sortoutput = true;
+	opts->gridthreads = 4;
+	opts->region = NULL;
+}
+
+// The functions below are the library API. Errors are caught and
+// returned in the status instead of terminating the process, and all
+// memory and file handles are released before returning, so they can be
+// called for any number of granules and from several threads at once.
+// HDF5 and netCDF calls are made by the I/O thread, the rest runs
+// concurrently.
+
+// Resample band file h5file (SVMxx) using geolocation file geofile (GMODO).
+Status
+viirs_resample_band(const char *geofile, const char *h5file, const ResamOpts *opts)
+{
+	Status st = {STATUS_OK, ""};
+
+	try{
+		st.skipped = !run_band(h5file, geofile, NULL, opts);
+	}catch(const std::exception &e){
+		seterror(&st, e.what());
+	}
+	return st;
+}
+
+// Read geolocation file geofile (GMODO) into a new plan, which can be
+// used for resampling all the bands of the granule. The plan is not
+// changed by resampling, so it can be shared between threads.
+// On error, *plan is set to NULL.
+Status
+viirs_geoplan_create(const char *geofile, GeoPlan **plan)
+{
+	Status st = {STATUS_OK, ""};
+
+	*plan = new GeoPlan;
+	try{
+		readgeoplan(geofile, *plan);
+	}catch(const std::exception &e){
+		seterror(&st, e.what());
+		delete *plan;
+		*plan = NULL;
+	}
+	return st;
+}
+
+void
+viirs_geoplan_free(GeoPlan *plan)
+{
+	delete plan;
+}
+
+// Resample band file h5file (SVMxx) using the geolocation in plan.
+// With opts->region, the geolocation is read again from plan->geofile.
+Status
+viirs_resample_band_plan(const GeoPlan *plan, const char *h5file, const ResamOpts *opts)
+{
+	Status st = {STATUS_OK, ""};
+
+	try{
+		st.skipped = !run_band(h5file, plan->geofile, plan, opts);
+	}catch(const std::exception &e){
+		seterror(&st, e.what());
+	}
+	return st;
+}
+
+// Read h5file into a new job for viirs_band_read and viirs_band_read_swath.
+static Status
+bandread(const char *geofile, const GeoPlan *plan, const Seam *seam, const char *h5file,
+	const ResamOpts *opts, BandJob **job)
+{
+	Status st = {STATUS_OK, ""};
+
+	*job = newbandjob(h5file, geofile != NULL ? geofile : plan->geofile, plan, seam, opts);
+	try{
+		if(skipband(*job)){
+			st.skipped = true;
+			(*job)->st = st;
+			freebandjob(*job);
+			*job = NULL;
+			return st;
+		}
+		readband(*job);
+	}catch(const std::exception &e){
+		seterror(&st, e.what());
+		(*job)->st = st;
+		freebandjob(*job);
+		*job = NULL;
+	}
+	return st;
+}
+
+// The band resampling of viirs_resample_band, split into stages so that
+// reading and writing files can be overlapped with resampling other
+// bands: viirs_band_read reads h5file (and the geolocation in geofile
+// if plan is NULL) into a new job, viirs_band_compute resamples it in
+// memory, and viirs_band_write writes it back. The stages of a job must
+// be run in that order, but can be run by different threads. The job
+// is freed with viirs_band_free, after an error or the last stage,
+// which also ends its report.
+// On error, or if h5file is skipped because it was already resampled,
+// viirs_band_read sets *job to NULL.
+Status
+viirs_band_read(const char *geofile, const GeoPlan *plan, const char *h5file,
+	const ResamOpts *opts, BandJob **job)
+{
+	return bandread(geofile, plan, NULL, h5file, opts, job);
+}
+
+// Same as viirs_band_read with plan, for a granule of a swath: the
+// rows of the neighboring granules in seam that plan also has are
+// resampled with the band, so it's resampled the same way as in the
+// whole swath. Only the band's own rows are written.
+Status
+viirs_band_read_swath(const GeoPlan *plan, const char *h5file, const Seam *seam,
+	const ResamOpts *opts, BandJob **job)
+{
+	return bandread(NULL, plan, seam, h5file, opts, job);
+}
+
+Status
+viirs_band_compute(BandJob *job)
+{
+	Status st = {STATUS_OK, ""};
+
+	try{
+		computeband(job);
+	}catch(const std::exception &e){
+		seterror(&st, e.what());
+		job->st = st;
+	}
+	return st;
+}
+
+Status
+viirs_band_write(BandJob *job)
+{
+	Status st = {STATUS_OK, ""};
+
+	try{
+		writeband(job);
+	}catch(const std::exception &e){
+		seterror(&st, e.what());
+		job->st = st;
+	}
+	return st;
+}
+
+void
+viirs_band_free(BandJob *job)
+{
+	freebandjob(job);
+}
+
+static Status
+resample_tcgeo(const char *gmodofile, const GeoPlan *plan, const char *gmtcofile, const Seam *seam,
+	const ResamOpts *opts)
+{
+	Status st = {STATUS_OK, ""};
+	Report report;
+
+	report_init(&report);
+	try{
+		ReportScope rs(&report);
+		CaptureScope cs(gmtcofile);
+		if(skipfile(gmtcofile, opts)){
+			st.skipped = true;
+		}else{
+			run_tcgeo(gmodofile, gmtcofile, plan, seam, opts);
+		}
+	}catch(const std::exception &e){
+		seterror(&st, e.what());
+	}
+	report_end(opts->report, &report, gmodofile, gmtcofile, &st);
+	return st;
+}
+
+// Resample terrain-corrected geolocation file gmtcofile (GMTCO)
+// using geolocation file gmodofile (GMODO).
+Status
+viirs_resample_tcgeo(const char *gmodofile, const char *gmtcofile, const ResamOpts *opts)
+{
+	return resample_tcgeo(gmodofile, NULL, gmtcofile, NULL, opts);
+}
+
+// Same as viirs_resample_tcgeo with the geolocation in plan, for a
+// granule of a swath like viirs_band_read_swath.
+Status
+viirs_resample_tcgeo_swath(const GeoPlan *plan, const char *gmtcofile, const Seam *seam,
+	const ResamOpts *opts)
+{
+	return resample_tcgeo(plan->geofile, plan, gmtcofile, seam, opts);
+}
+
+// Set names to the datasets of file that are resampled, latitude and
+// longitude for GMODO and GMTCO files, and return how many there are.
+// Other files have none.
+int
+viirs_datasets(const char *file, char names[][128])
+{
+	int is;
+
+	switch(getfiletype(file)){
+	case GMODO:
+		snprintf(names[0], 128, "%s", LATNAME);
+		snprintf(names[1], 128, "%s", LONNAME);
+		return 2;
+	case GMTCO:
+		snprintf(names[0], 128, "%s", _TCLATNAME);
+		snprintf(names[1], 128, "%s", _TCLONNAME);
+		return 2;
+	case ACSPO:
+	case L2P_GHRSST:
+		return 0;
+	}
+	is = getbandname(file);
+	if(is < 1 || is > NBANDS){
+		return 0;
+	}
+	if(is<12) {
+		snprintf(names[0], 128, "All_Data/VIIRS-M%i-SDR_All/Reflectance", is);
+	} else {
+		snprintf(names[0], 128, "All_Data/VIIRS-M%i-SDR_All/BrightnessTemperature", is);
+	}
+	return 1;
+}
+
+// Set *done if file, a band or GMTCO file, has already been resampled,
+// going by its resampling attribute, without reading any dataset.
+// Other files have no such attribute and are never done: GMODO files
+// are only read, and ACSPO and L2P GHRSST files are reordered anew.
+// A band file with a rows attribute was only resampled in part (by
+// earlier versions, which also wrote the resampling attribute then),
+// and isn't done.
+Status
+viirs_resampled(const char *file, bool *done)
+{
+	Status st = {STATUS_OK, ""};
+	char field[128], name[128], rowsname[160];
+	int is;
+
+	rowsname[0] = '\0';
+	*done = false;
+	switch(getfiletype(file)){
+	case GMTCO:
+		snprintf(field, sizeof(field), "%s", _TCLATNAME);
+		snprintf(name, sizeof(name), "%s", GEO_RESAM_ATTR_NAME);
+		break;
+	case GMODO:
+	case ACSPO:
+	case L2P_GHRSST:
+		return st;
+	default:
+		is = getbandname(file);
+		if(is < 1 || is > NBANDS){
+			// not a band file; resampling it reports the error
+			return st;
+		}
+		bandattr(is, field, name);
+		snprintf(rowsname, sizeof(rowsname), "%sRows", name);
+		break;
+	}
+	try{
+		int n = viirs_attribute_exists(file, field, name);
+		if(n > 0 && rowsname[0] != '\0'){
+			n = viirs_attribute_exists(file, field, rowsname);
+			if(n >= 0){
+				n = !n;
+			}
+		}
+		if(n < 0){
+			st.code = STATUS_ERROR;
+			snprintf(st.msg, sizeof(st.msg), "cannot read resampling attribute %s of %s", name, file);
+			return st;
+		}
+		*done = n > 0;
+	}catch(const std::exception &e){
+		seterror(&st, e.what());
+	}
+	return st;
+}
+
+// Sort latitude and longitude of geolocation file geofile in place.
+Status
+viirs_sort_latlon(const char *geofile)
+{
+	Status st = {STATUS_OK, ""};
+
+	try{
+		sortlatlon(geofile);
+	}catch(const std::exception &e){
+		seterror(&st, e.what());
+	}
+	return st;
+}
+
+// Reorder L2P GHRSST netCDF file ncfile in place.
+Status
+viirs_reorder_ghrsst(const char *ncfile)
+{
+	Status st = {STATUS_OK, ""};
+
+	try{
+		io_call(reorder_ghrsst, (void*)ncfile);
+	}catch(const std::exception &e){
+		seterror(&st, e.what());
+	}
+	return st;
+}
+
+// Reorder ACSPO netCDF file ncfile in place.
+Status
+viirs_reorder_acspo(const char *ncfile)
+{
+	Status st = {STATUS_OK, ""};
+
+	try{
+		io_call(reorder_acspo, (void*)ncfile);
+	}catch(const std::exception &e){
+		seterror(&st, e.what());
+	}
+	return st;
+}
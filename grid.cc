@@ -0,0 +1,342 @@
+//
+// Gridding of resampled bands onto a regular latitude/longitude grid
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <hdf5.h>
+#include "viirsresam.h"
+
+// A band is gridded in memory right after being resampled, with the
+// geolocation of the resampled pixels: sorted latitude and interpolated
+// longitude. The grid covers the bounding box of the swath, and is
+// divided into stripes of rows, binned in parallel by a pool of threads,
+// each writing only to its own rows. The pool is shared by all the bands
+// gridded at once, so --grid-threads doesn't multiply with -j. The swath is walked by cells of a
+// scan by INDEXCOLS columns, skipping those whose GeoIndex box is
+// outside the stripe, and the pixels of a cell are read a row at a time.
+// Since the swath is sorted in latitude, a stripe takes few cells beyond
+// its own, and they fall in nearby grid rows, which stay in cache.
+
+enum {
+	STRIPESPERTHREAD = 4,	// stripes of a grid per thread, for load balancing
+};
+
+// Stripes of a band not binned yet, so a band can wait for its own
+// stripes while the pool bins those of others too.
+struct Pending {
+	pthread_mutex_t	lock;
+	pthread_cond_t	done;	// signaled when n drops to 0
+	int	n;
+};
+
+// Stripe of grid rows [row0, row1) binned by a thread.
+struct Stripe {
+	const Mat	*img, *lat, *lon;
+	const GeoIndex	*idx;
+	double	scale, offset;
+	Grid	*g;
+	int	row0, row1;
+	Mat	*sum;	// CV_64FC1, sum of the values in each cell
+	Pending	*pend;	// if not NULL, counted down when the stripe is binned
+};
+
+static pthread_mutex_t stripelock = PTHREAD_MUTEX_INITIALIZER;	// guards stripepool
+static Pool *stripepool;	// bins the stripes of all bands; never freed
+
+// Physical value of band value v, or NAN for a fill value.
+static inline float
+physval(ushort v, double scale, double offset)
+{
+	return isushortfill(v) ? NAN : scale*v + offset;
+}
+
+static inline float
+physval(float v, double scale, double offset)
+{
+	return isfloatfill(v) ? NAN : v;
+}
+
+// Column of g of longitude lon, or -1 if it's outside the grid.
+// Inv is 1/g->res.
+static inline int
+gridcol(const Grid *g, double inv, float lon)
+{
+	double d = lon - g->lon0;
+	if(d < 0)
+		d += 360;
+	int c = d*inv;
+	if(c >= g->cols && g->cols*g->res >= 360)
+		c -= g->cols;
+	return c < g->cols ? c : -1;
+}
+
+template <class T>
+static void
+binstripe_(Stripe *s)
+{
+	const GeoIndex *idx = s->idx;
+	Grid *g = s->g;
+	double inv = 1/g->res;
+	double *sum = s->sum->ptr<double>(0);
+	int *count = g->count.ptr<int>(0);
+	double latlo = g->lat0 + s->row0*g->res;
+	double lathi = g->lat0 + s->row1*g->res;
+
+	for(int k = 0; k < idx->nscans; k++){
+		for(int b = 0; b < idx->nblocks; b++){
+			const GeoBox *box = &idx->cells[k*idx->nblocks + b];
+			// a cell more to be safe from rounding at the edges of the stripe
+			if(box->latmin > box->latmax || box->latmax < latlo - g->res || box->latmin >= lathi + g->res){
+				continue;
+			}
+			int y1 = MIN((k+1)*NDETECTORS, idx->rows);
+			int x0 = b*INDEXCOLS;
+			int x1 = MIN((b+1)*INDEXCOLS, idx->cols);
+			for(int y = k*NDETECTORS; y < y1; y++){
+				const T *ip = s->img->ptr<T>(y);
+				const float *la = s->lat->ptr<float>(y);
+				const float *lo = s->lon->ptr<float>(y);
+				for(int x = x0; x < x1; x++){
+					if(!validgeo(la[x], lo[x])){
+						continue;
+					}
+					// la >= lat0, so truncating is floor
+					int r = (la[x] - g->lat0)*inv;
+					if(r < s->row0 || r >= s->row1){
+						continue;
+					}
+					float v = physval(ip[x], s->scale, s->offset);
+					int c = gridcol(g, inv, lo[x]);
+					if(isnan(v) || c < 0){
+						continue;
+					}
+					sum[(long)r*g->cols + c] += v;
+					count[(long)r*g->cols + c]++;
+				}
+			}
+		}
+	}
+	for(int r = s->row0; r < s->row1; r++){
+		const double *sp = s->sum->ptr<double>(r);
+		const int *np = g->count.ptr<int>(r);
+		float *mp = g->mean.ptr<float>(r);
+		for(int c = 0; c < g->cols; c++){
+			mp[c] = np[c] > 0 ? sp[c]/np[c] : NA_FLOAT32_FILL;
+		}
+	}
+}
+
+static void
+binstripe(void *arg)
+{
+	Stripe *s = (Stripe*)arg;
+
+	if(s->img->type() == CV_16UC1){
+		binstripe_<ushort>(s);
+	}else{
+		binstripe_<float>(s);
+	}
+	if(s->pend != NULL){
+		pthread_mutex_lock(&s->pend->lock);
+		if(--s->pend->n == 0)
+			pthread_cond_signal(&s->pend->done);
+		pthread_mutex_unlock(&s->pend->lock);
+	}
+}
+
+// The pool binning stripes, created with nthreads threads by the first
+// band gridded with more than one.
+static Pool*
+getstripepool(int nthreads)
+{
+	pthread_mutex_lock(&stripelock);
+	try{
+		if(stripepool == NULL)
+			stripepool = pool_create(nthreads);
+	}catch(...){
+		pthread_mutex_unlock(&stripelock);
+		throw;
+	}
+	pthread_mutex_unlock(&stripelock);
+	return stripepool;
+}
+
+// Set the extent of g to the bounding box of idx, in cells of res degrees.
+static void
+gridextent(Grid *g, const GeoIndex *idx, double res)
+{
+	const GeoBox *box = &idx->tree[1];
+
+	if(box->latmin > box->latmax){
+		eprintf("no valid geolocation to grid");
+	}
+	// rows and columns computed as in binstripe_, so that the
+	// pixels at the edges of the box fall inside the grid
+	double inv = 1/res;
+	g->res = res;
+	g->lat0 = floor(box->latmin/res)*res;
+	g->rows = (int)((box->latmax - g->lat0)*inv) + 1;
+	g->lon0 = floor(box->lonmin/res)*res;
+	double d = box->lonmax - g->lon0;
+	if(d < 0)
+		d += 360;
+	g->cols = (int)(d*inv) + 1;
+	if(g->cols*res >= 360){
+		g->lon0 = -180;
+		g->cols = (int)ceil(360/res);
+	}
+}
+
+// Grid band image img (CV_16UC1 of scaling scale and offset, or
+// CV_32FC1 for band M13) with geolocation lat and lon of its pixels,
+// as given by the resampling, into g: the mean of the valid values
+// in cells of res degrees covering the swath. Stripes of the grid are
+// binned by a pool of threads shared by all the bands, of nthreads
+// threads as given by the first call with more than one.
+//
+void
+grid_band(const Mat &img, double scale, double offset, const Mat &lat, const Mat &lon,
+	double res, int nthreads, Grid *g)
+{
+	GeoIndex *idx;
+
+	CV_Assert(img.type() == CV_16UC1 || img.type() == CV_32FC1);
+	CV_Assert(img.isContinuous() && img.size() == lat.size());
+	if(res <= 0 || res > 90){
+		eprintf("invalid grid resolution %g", res);
+	}
+	Status st = viirs_geoindex_build(lat, lon, &idx);
+	if(st.code != STATUS_OK){
+		eprintf("%s", st.msg);
+	}
+	try{
+		gridextent(g, idx, res);
+		g->mean.create(g->rows, g->cols, CV_32FC1);
+		g->count = Mat::zeros(g->rows, g->cols, CV_32SC1);
+		Mat sum = Mat::zeros(g->rows, g->cols, CV_64FC1);
+
+		int n = MIN(g->rows, MAX(nthreads, 1)*STRIPESPERTHREAD);
+		vector<Stripe> stripes(n);
+		for(int i = 0; i < n; i++){
+			Stripe *s = &stripes[i];
+			s->img = &img;
+			s->lat = &lat;
+			s->lon = &lon;
+			s->idx = idx;
+			s->scale = scale;
+			s->offset = offset;
+			s->g = g;
+			s->row0 = (long)g->rows*i/n;
+			s->row1 = (long)g->rows*(i+1)/n;
+			s->sum = &sum;
+			s->pend = NULL;
+		}
+		if(nthreads <= 1){
+			for(int i = 0; i < n; i++){
+				binstripe(&stripes[i]);
+			}
+		}else{
+			Pool *pool = getstripepool(nthreads);
+			Pending pend;
+			pthread_mutex_init(&pend.lock, NULL);
+			pthread_cond_init(&pend.done, NULL);
+			pend.n = n;
+			for(int i = 0; i < n; i++){
+				stripes[i].pend = &pend;
+				pool_submit(pool, binstripe, &stripes[i]);
+			}
+			pthread_mutex_lock(&pend.lock);
+			while(pend.n > 0){
+				pthread_cond_wait(&pend.done, &pend.lock);
+			}
+			pthread_mutex_unlock(&pend.lock);
+			pthread_cond_destroy(&pend.done);
+			pthread_mutex_destroy(&pend.lock);
+		}
+	}catch(...){
+		viirs_geoindex_free(idx);
+		throw;
+	}
+	viirs_geoindex_free(idx);
+}
+
+// Write dataset name of data to HDF5 file f.
+static void
+h5grid_dataset(hid_t f, const char *name, hid_t dtype, int rank, const hsize_t *dims, const void *data)
+{
+	hid_t space = H5Screate_simple(rank, dims, NULL);
+	if(space < 0){
+		eprintf("cannot create HDF5 dataspace for dataset %s", name);
+	}
+	hid_t ds = H5Dcreate(f, name, dtype, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+	if(ds < 0){
+		eprintf("cannot create HDF5 dataset %s", name);
+	}
+	if(H5Dwrite(ds, dtype, H5S_ALL, H5S_ALL, H5P_DEFAULT, data) < 0){
+		eprintf("cannot write HDF5 dataset %s", name);
+	}
+	H5Dclose(ds);
+	H5Sclose(space);
+}
+
+static void
+h5grid_write(const Grid *g, const char *path, const char *name)
+{
+	vector<float> lat(g->rows), lon(g->cols);
+	hsize_t dims[2];
+
+	for(int r = 0; r < g->rows; r++){
+		lat[r] = g->lat0 + (r + 0.5)*g->res;
+	}
+	for(int c = 0; c < g->cols; c++){
+		double l = g->lon0 + (c + 0.5)*g->res;
+		lon[c] = l >= 180 ? l - 360 : l;
+	}
+	if(H5open() < 0){
+		eprintf("cannot initialize HDF5 library");
+	}
+	hid_t f = H5Fcreate(path, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+	if(f < 0){
+		eprintf("cannot create HDF5 file %s", path);
+	}
+	dims[0] = g->rows;
+	h5grid_dataset(f, "Latitude", H5T_NATIVE_FLOAT, 1, dims, &lat[0]);
+	dims[0] = g->cols;
+	h5grid_dataset(f, "Longitude", H5T_NATIVE_FLOAT, 1, dims, &lon[0]);
+	dims[0] = g->rows;
+	dims[1] = g->cols;
+	h5grid_dataset(f, name, H5T_NATIVE_FLOAT, 2, dims, g->mean.data);
+	h5grid_dataset(f, "Count", H5T_NATIVE_INT, 2, dims, g->count.data);
+	if(H5Fclose(f) < 0){
+		eprintf("cannot close HDF5 file %s", path);
+	}
+}
+
+struct GridReq {
+	const Grid	*g;
+	const char	*path, *name;
+};
+
+static void
+gridreq(void *arg)
+{
+	GridReq *r = (GridReq*)arg;
+	Timer t(STAGE_H5WRITE);
+
+	h5grid_write(r->g, r->path, r->name);
+	report_bytes(0, (double)r->g->rows*r->g->cols*(sizeof(float) + sizeof(int)));
+}
+
+// Write grid g to a new HDF5 file path, with the mean values in
+// dataset name, the number of pixels averaged in dataset Count,
+// and the latitude and longitude of the centers of the rows and
+// columns in datasets Latitude and Longitude.
+//
+void
+grid_write(const Grid *g, const char *path, const char *name)
+{
+	GridReq r = {g, path, name};
+	io_call(gridreq, &r);
+}
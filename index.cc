@@ -0,0 +1,340 @@
+//
+// Spatial index of the geolocation of a resampled granule
+//
+
+#include <stdio.h>
+#include <string.h>
+#include "viirsresam.h"
+
+// The geolocation is divided into cells of a scan (NDETECTORS rows)
+// by INDEXCOLS columns, and the index keeps the latitude/longitude box
+// of each cell. The box of a cell also covers the pixels around it, so
+// a point of the swath between four pixels is in the box of the cell
+// of at least one of them. The boxes of the scans are the leaves of a
+// binary tree, each node the union of its children, so a query only
+// looks at the cells of the scans near the box it's given instead of
+// at every pixel, as matchups used to.
+
+static const GeoBox emptybox = {INFINITY, -INFINITY, 0, 0};
+
+static bool
+isempty(const GeoBox *b)
+{
+	return b->latmin > b->latmax;
+}
+
+// Longitude range of b as [*lo, *hi], with *hi < *lo+360.
+static void
+lonrange(const GeoBox *b, double *lo, double *hi)
+{
+	*lo = b->lonmin;
+	*hi = b->lonmax < b->lonmin ? b->lonmax+360 : b->lonmax;
+}
+
+static double
+wraplon(double lon)
+{
+	if(lon < -180)
+		return lon + 360;
+	if(lon > 180)
+		return lon - 360;
+	return lon;
+}
+
+// Set the longitude range of b to [lo, hi], which may be
+// past the antimeridian on either side.
+static void
+setlonrange(GeoBox *b, double lo, double hi)
+{
+	if(hi - lo >= 360){
+		b->lonmin = -180;
+		b->lonmax = 180;
+		return;
+	}
+	b->lonmin = wraplon(lo);
+	b->lonmax = wraplon(hi);
+}
+
+// Extend box a to cover box b.
+static void
+boxunion(GeoBox *a, const GeoBox *b)
+{
+	double alo, ahi, blo, bhi;
+
+	if(isempty(b)){
+		return;
+	}
+	if(isempty(a)){
+		*a = *b;
+		return;
+	}
+	lonrange(a, &alo, &ahi);
+	lonrange(b, &blo, &bhi);
+
+	// b on the same side of the antimeridian as a
+	double d = (blo+bhi)/2 - (alo+ahi)/2;
+	if(d > 180){
+		blo -= 360;
+		bhi -= 360;
+	}else if(d < -180){
+		blo += 360;
+		bhi += 360;
+	}
+	a->latmin = MIN(a->latmin, b->latmin);
+	a->latmax = MAX(a->latmax, b->latmax);
+	setlonrange(a, MIN(alo, blo), MAX(ahi, bhi));
+}
+
+static bool
+overlaps(const GeoBox *a, const GeoBox *b)
+{
+	double alo, ahi, blo, bhi;
+
+	if(isempty(a) || isempty(b) || a->latmax < b->latmin || b->latmax < a->latmin){
+		return false;
+	}
+	lonrange(a, &alo, &ahi);
+	lonrange(b, &blo, &bhi);
+	for(int k = -1; k <= 1; k++){
+		if(alo <= bhi + 360*k && blo + 360*k <= ahi){
+			return true;
+		}
+	}
+	return false;
+}
+
+// Pixels of the cell of scan s and column block b,
+// with the pixels around it.
+static Rect
+cellrect(const GeoIndex *idx, int s, int b)
+{
+	int y0 = MAX(s*NDETECTORS - 1, 0);
+	int y1 = MIN((s+1)*NDETECTORS + 1, idx->rows);
+	int x0 = MAX(b*INDEXCOLS - 1, 0);
+	int x1 = MIN((b+1)*INDEXCOLS + 1, idx->cols);
+	return Rect(x0, y0, x1-x0, y1-y0);
+}
+
+// Box of the valid pixels of lat and lon in r. The longitudes
+// are taken on the side of the antimeridian of the first one,
+// since a cell is much less than 180 degrees wide.
+static GeoBox
+cellbox(const Mat &lat, const Mat &lon, Rect r)
+{
+	GeoBox b = emptybox;
+	double ref = 0, lo = 0, hi = 0;
+
+	for(int y = r.y; y < r.y + r.height; y++){
+		const float *la = lat.ptr<float>(y);
+		const float *lp = lon.ptr<float>(y);
+		for(int x = r.x; x < r.x + r.width; x++){
+			if(!validgeo(la[x], lp[x])){
+				continue;
+			}
+			double l = lp[x];
+			if(isempty(&b)){
+				ref = lo = hi = l;
+			}else{
+				if(l < ref-180)
+					l += 360;
+				else if(l >= ref+180)
+					l -= 360;
+				lo = MIN(lo, l);
+				hi = MAX(hi, l);
+			}
+			b.latmin = MIN(b.latmin, la[x]);
+			b.latmax = MAX(b.latmax, la[x]);
+		}
+	}
+	if(!isempty(&b)){
+		setlonrange(&b, lo, hi);
+	}
+	return b;
+}
+
+// Build the tree over the cells of idx.
+static void
+buildtree(GeoIndex *idx)
+{
+	int m = 1;
+
+	while(m < idx->nscans){
+		m *= 2;
+	}
+	idx->tree.assign(2*m, emptybox);
+	for(int s = 0; s < idx->nscans; s++){
+		for(int b = 0; b < idx->nblocks; b++){
+			boxunion(&idx->tree[m+s], &idx->cells[s*idx->nblocks + b]);
+		}
+	}
+	for(int i = m-1; i >= 1; i--){
+		idx->tree[i] = idx->tree[2*i];
+		boxunion(&idx->tree[i], &idx->tree[2*i+1]);
+	}
+}
+
+// Build the spatial index of geolocation lat and lon into *idx.
+// On error, *idx is set to NULL.
+Status
+viirs_geoindex_build(const Mat &lat, const Mat &lon, GeoIndex **idx)
+{
+	Status st = {STATUS_OK, ""};
+
+	*idx = NULL;
+	try{
+		CHECKMAT(lat, CV_32FC1);
+		CHECKMAT(lon, CV_32FC1);
+		CV_Assert(lat.size() == lon.size());
+		GeoIndex *g = new GeoIndex;
+		g->rows = lat.rows;
+		g->cols = lat.cols;
+		g->nscans = (lat.rows + NDETECTORS-1)/NDETECTORS;
+		g->nblocks = (lat.cols + INDEXCOLS-1)/INDEXCOLS;
+		g->cells.resize(g->nscans*g->nblocks);
+		for(int s = 0; s < g->nscans; s++){
+			for(int b = 0; b < g->nblocks; b++){
+				g->cells[s*g->nblocks + b] = cellbox(lat, lon, cellrect(g, s, b));
+			}
+		}
+		buildtree(g);
+		*idx = g;
+	}catch(const std::exception &e){
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "%s", e.what());
+	}
+	return st;
+}
+
+// Write idx to file path: an IndexHdr followed by the cells.
+Status
+viirs_geoindex_write(const GeoIndex *idx, const char *path)
+{
+	Status st = {STATUS_OK, ""};
+	IndexHdr h;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+	h.rows = idx->rows;
+	h.cols = idx->cols;
+	h.cellrows = NDETECTORS;
+	h.cellcols = INDEXCOLS;
+	h.nscans = idx->nscans;
+	h.nblocks = idx->nblocks;
+
+	FILE *f = fopen(path, "w");
+	if(f == NULL){
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "cannot create %s: %s", path, strerror(errno));
+		return st;
+	}
+	size_t n = idx->cells.size();
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(&idx->cells[0], sizeof(GeoBox), n, f) == n;
+	if(fclose(f) != 0 || !ok){
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "cannot write %s: %s", path, strerror(errno));
+	}
+	return st;
+}
+
+// Read the index in file path, written by viirs_geoindex_write,
+// into *idx. On error, *idx is set to NULL.
+Status
+viirs_geoindex_read(const char *path, GeoIndex **idx)
+{
+	Status st = {STATUS_OK, ""};
+	IndexHdr h;
+
+	*idx = NULL;
+	FILE *f = fopen(path, "r");
+	if(f == NULL){
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "cannot open %s: %s", path, strerror(errno));
+		return st;
+	}
+	if(fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, INDEX_MAGIC, sizeof(h.magic)) != 0
+	|| h.cellrows != NDETECTORS || h.cellcols != INDEXCOLS || h.rows <= 0 || h.cols <= 0
+	|| h.nscans != (h.rows + NDETECTORS-1)/NDETECTORS
+	|| h.nblocks != (h.cols + INDEXCOLS-1)/INDEXCOLS){
+		fclose(f);
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "%s is not an index file", path);
+		return st;
+	}
+	GeoIndex *g = new GeoIndex;
+	g->rows = h.rows;
+	g->cols = h.cols;
+	g->nscans = h.nscans;
+	g->nblocks = h.nblocks;
+	size_t n = g->nscans*g->nblocks;
+	g->cells.resize(n);
+	if(fread(&g->cells[0], sizeof(GeoBox), n, f) != n){
+		fclose(f);
+		delete g;
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "%s is truncated", path);
+		return st;
+	}
+	fclose(f);
+	buildtree(g);
+	*idx = g;
+	return st;
+}
+
+void
+viirs_geoindex_free(GeoIndex *idx)
+{
+	delete idx;
+}
+
+// Add the blocks of the cells under node of the tree of idx
+// whose box overlaps box. Adjacent cells are merged in one block.
+static void
+query(const GeoIndex *idx, int node, const GeoBox *box, vector<Rect> &blocks)
+{
+	int m = idx->tree.size()/2;
+
+	if(!overlaps(&idx->tree[node], box)){
+		return;
+	}
+	if(node < m){
+		query(idx, 2*node, box, blocks);
+		query(idx, 2*node+1, box, blocks);
+		return;
+	}
+	int s = node - m;
+	const GeoBox *cells = &idx->cells[s*idx->nblocks];
+	for(int b = 0; b < idx->nblocks; b++){
+		if(!overlaps(&cells[b], box)){
+			continue;
+		}
+		int b1 = b+1;
+		while(b1 < idx->nblocks && overlaps(&cells[b1], box)){
+			b1++;
+		}
+		blocks.push_back(cellrect(idx, s, b) | cellrect(idx, s, b1-1));
+		b = b1;
+	}
+}
+
+// Set blocks to the candidate pixels of idx for box: rectangles of
+// the geolocation indexed, in row order, holding every pixel inside
+// box as well as the pixels next to them, so a point of box between
+// pixels of the swath is between pixels of a block. The blocks of
+// consecutive scans overlap by two rows. Returns the number of blocks.
+int
+viirs_geoindex_query(const GeoIndex *idx, const GeoBox *box, vector<Rect> &blocks)
+{
+	blocks.clear();
+	query(idx, 1, box, blocks);
+	return blocks.size();
+}
+
+// Same as viirs_geoindex_query for the point at lat, lon,
+// such as the location of a buoy to match up.
+int
+viirs_geoindex_point(const GeoIndex *idx, float lat, float lon, vector<Rect> &blocks)
+{
+	GeoBox box = {lat, lat, lon, lon};
+
+	return viirs_geoindex_query(idx, &box, blocks);
+}
@@ -0,0 +1,121 @@
+//
+// Thread running all the HDF5 and netCDF calls
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include "viirsresam.h"
+
+// Request for the I/O thread, and the future for its result.
+struct IOReq {
+	void	(*fn)(void *arg);
+	void	*arg;
+	Report	*report;	// report of the submitting thread
+	bool	done;
+	bool	failed;	// fn threw an exception
+	char	msg[256];	// its message
+};
+
+static pthread_once_t ioonce = PTHREAD_ONCE_INIT;
+static Pool *iopool;	// pool with the single I/O thread
+static char ioerr[256];	// why iopool could not be created
+static pthread_mutex_t iolock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t iodone = PTHREAD_COND_INITIALIZER;	// signaled when a request is done
+static __thread bool onio;	// running on the I/O thread
+
+static void
+iostart()
+{
+	sigset_t all, old;
+
+	// the I/O thread doesn't take signals meant for the program
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	try{
+		iopool = pool_create(1);
+	}catch(const std::exception &e){
+		snprintf(ioerr, sizeof(ioerr), "cannot start I/O thread: %s", e.what());
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+static void
+runreq(void *arg)
+{
+	IOReq *r = (IOReq*)arg;
+	ReportScope rs(r->report);
+
+	onio = true;
+	try{
+		r->fn(r->arg);
+	}catch(const std::exception &e){
+		r->failed = true;
+		snprintf(r->msg, sizeof(r->msg), "%s", e.what());
+	}
+	h5closeall();
+
+	pthread_mutex_lock(&iolock);
+	r->done = true;
+	pthread_cond_broadcast(&iodone);
+	pthread_mutex_unlock(&iolock);
+}
+
+// Queue fn(arg) to be run by the I/O thread, which is started on first
+// use. Requests are run one at a time in the order they're submitted.
+// The returned future must be passed to io_wait. The time and bytes
+// of the request count in the report of the calling thread.
+//
+IOReq*
+io_submit(void (*fn)(void *arg), void *arg)
+{
+	pthread_once(&ioonce, iostart);
+	if(iopool == NULL){
+		eprintf("%s", ioerr);
+	}
+	IOReq *r = new IOReq;
+	r->fn = fn;
+	r->arg = arg;
+	r->report = report_current();
+	r->done = false;
+	r->failed = false;
+	r->msg[0] = '\0';
+	pool_submit(iopool, runreq, r);
+	return r;
+}
+
+// Wait for request r to finish and free it. An exception thrown
+// by the request is thrown again here as an Error.
+//
+void
+io_wait(IOReq *r)
+{
+	char msg[256];
+
+	pthread_mutex_lock(&iolock);
+	while(!r->done){
+		pthread_cond_wait(&iodone, &iolock);
+	}
+	pthread_mutex_unlock(&iolock);
+
+	bool failed = r->failed;
+	memcpy(msg, r->msg, sizeof(msg));
+	delete r;
+	if(failed){
+		eprintf("%s", msg);
+	}
+}
+
+// Run fn(arg) on the I/O thread and wait for it. Calls made from the
+// I/O thread itself are run directly.
+//
+void
+io_call(void (*fn)(void *arg), void *arg)
+{
+	if(onio){
+		fn(arg);
+		return;
+	}
+	io_wait(io_submit(fn, arg));
+}
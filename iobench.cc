@@ -0,0 +1,280 @@
+//
+// Benchmark of the HDF5 I/O of band resampling, for several dataset
+// layouts and file drivers
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <hdf5.h>
+#include "viirsresam.h"
+
+#define GEOLAT	"All_Data/VIIRS-MOD-GEO_All/Latitude"
+#define GEOLON	"All_Data/VIIRS-MOD-GEO_All/Longitude"
+#define BAND	"All_Data/VIIRS-M15-SDR_All/BrightnessTemperature"
+#define AGGR	"Data_Products/VIIRS-M15-SDR/VIIRS-M15-SDR_Aggr"
+#define ATTR	"ResamplingBrightnessTemperature"
+
+char *progname;
+
+enum {
+	CONTIGUOUS,
+	CHUNKED,
+	DEFLATE,
+	NLAYOUTS,
+};
+
+static const char *layoutnames[NLAYOUTS] = {
+	"contiguous",
+	"chunked",
+	"deflate",
+};
+
+static const char *drivers[] = {
+	"sec2",
+	"core",
+	"stdio",
+};
+
+// Files to create, with their data.
+struct MkFiles {
+	const char	*dir;
+	int	layout;
+	int	height;
+	const float	*lat, *lon;
+	const ushort	*band;
+	char	geofile[1024], bandfile[1024];
+};
+
+static void
+h5check(herr_t err, const char *what)
+{
+	if(err < 0){
+		eprintf("%s failed", what);
+	}
+}
+
+// Create dataset name of the given type and size in file f, with the
+// groups leading to it, and write data to it.
+//
+static void
+put(hid_t f, const char *name, hid_t type, int ny, int nx, int layout, const void *data)
+{
+	hsize_t dims[2] = {(hsize_t)ny, (hsize_t)nx};
+	hsize_t chunk[2] = {(hsize_t)MIN(ny, NDETECTORS), (hsize_t)nx};
+	char path[256];
+
+	snprintf(path, sizeof(path), "%s", name);
+	for(char *p = strchr(path+1, '/'); p != NULL; p = strchr(p+1, '/')){
+		*p = '\0';
+		if(H5Lexists(f, path, H5P_DEFAULT) <= 0){
+			hid_t g = H5Gcreate(f, path, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+			h5check(g, "H5Gcreate");
+			H5Gclose(g);
+		}
+		*p = '/';
+	}
+
+	hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+	if(layout != CONTIGUOUS && nx > 0){
+		// one scan per chunk
+		h5check(H5Pset_chunk(dcpl, 2, chunk), "H5Pset_chunk");
+		if(layout == DEFLATE){
+			h5check(H5Pset_deflate(dcpl, 4), "H5Pset_deflate");
+		}
+	}
+	hid_t space = H5Screate_simple(nx > 0 ? 2 : 1, dims, NULL);
+	hid_t d = H5Dcreate(f, name, type, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+	h5check(d, "H5Dcreate");
+	h5check(H5Dwrite(d, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, data), "H5Dwrite");
+	H5Dclose(d);
+	H5Sclose(space);
+	H5Pclose(dcpl);
+}
+
+// Write the GMODO and M15 band files like the SDR products.
+// Run on the I/O thread.
+//
+static void
+mkfiles(void *arg)
+{
+	MkFiles *m = (MkFiles*)arg;
+	float factors[2] = {0.0025, 200};
+	float aggr = 0;
+
+	snprintf(m->geofile, sizeof(m->geofile), "%s/GMODO_iobench_%s.h5", m->dir, layoutnames[m->layout]);
+	snprintf(m->bandfile, sizeof(m->bandfile), "%s/SVM15_iobench_%s.h5", m->dir, layoutnames[m->layout]);
+
+	hid_t f = H5Fcreate(m->geofile, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+	h5check(f, m->geofile);
+	put(f, GEOLAT, H5T_NATIVE_FLOAT, m->height, VIIRS_WIDTH, m->layout, m->lat);
+	put(f, GEOLON, H5T_NATIVE_FLOAT, m->height, VIIRS_WIDTH, m->layout, m->lon);
+	h5check(H5Fclose(f), m->geofile);
+
+	f = H5Fcreate(m->bandfile, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+	h5check(f, m->bandfile);
+	put(f, BAND, H5T_NATIVE_USHORT, m->height, VIIRS_WIDTH, m->layout, m->band);
+	put(f, BAND "Factors", H5T_NATIVE_FLOAT, 2, 0, CONTIGUOUS, factors);
+	put(f, AGGR, H5T_NATIVE_FLOAT, 1, 0, CONTIGUOUS, &aggr);
+	h5check(H5Fclose(f), m->bandfile);
+}
+
+// Remove the resampling attribute, so that the next cycle writes it
+// again. Run on the I/O thread.
+//
+static void
+rmattr(void *arg)
+{
+	const char *file = (const char*)arg;
+
+	hid_t f = H5Fopen(file, H5F_ACC_RDWR, H5P_DEFAULT);
+	h5check(f, file);
+	hid_t d = H5Dopen(f, AGGR, H5P_DEFAULT);
+	h5check(d, AGGR);
+	if(H5Aexists(d, ATTR) > 0){
+		h5check(H5Adelete(d, ATTR), "H5Adelete");
+	}
+	H5Dclose(d);
+	h5check(H5Fclose(f), file);
+}
+
+// The I/O of resampling a band without a plan: read the band and the
+// geolocation, then write the band and the resampling attribute.
+// Returns the number of bytes read and written.
+//
+static double
+cycle(const MkFiles *m)
+{
+	Cbuf<ushort> band;
+	Cbuf<float> lat, lon;
+	uvlong dims[32];
+	float scale, offset;
+
+	if(readwrite_viirs_rows(&band.p, dims, &scale, &offset, m->bandfile, BAND, 0, 0, 0) != 0
+	|| readwrite_viirs_float_rows(&lat.p, dims, m->geofile, GEOLAT, 0, 0, 0) != 0
+	|| readwrite_viirs_float_rows(&lon.p, dims, m->geofile, GEOLON, 0, 0, 0) != 0){
+		eprintf("cannot read %s", m->bandfile);
+	}
+	if(readwrite_viirs_rows(&band.p, dims, &scale, &offset, m->bandfile, BAND, 1, 0, 0) != 0){
+		eprintf("cannot write %s", m->bandfile);
+	}
+	if(write_viirs_attribute(m->bandfile, AGGR, ATTR, 1.0) != 0){
+		eprintf("cannot write attribute in %s", m->bandfile);
+	}
+	double npix = (double)dims[0]*dims[1];
+	return npix*(2*sizeof(ushort) + 2*sizeof(float));
+}
+
+static double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+static double
+filesize(const char *file)
+{
+	struct stat sb;
+
+	if(stat(file, &sb) != 0){
+		return 0;
+	}
+	return sb.st_size;
+}
+
+static void
+usage()
+{
+	printf("usage: %s [-n cycles] [-r rows] [dir]\n", progname);
+	printf("\n");
+	printf("Write synthetic GMODO and band files in dir (default .) with contiguous,\n");
+	printf("chunked and deflate compressed datasets, and time the reads and writes\n");
+	printf("of resampling the band with each HDF5 file driver. The files are\n");
+	printf("likely in the page cache, so this measures HDF5 more than the disk.\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *dir = ".";
+	int ncycles = 5;
+	int height = 768;
+	char *end;
+
+	progname = argv[0];
+	for(int i = 1; i < argc; i++){
+		if(strcmp(argv[i], "-n") == 0 && i+1 < argc){
+			ncycles = strtol(argv[++i], &end, 10);
+			if(*end != '\0' || ncycles < 1)
+				usage();
+		}else if(strcmp(argv[i], "-r") == 0 && i+1 < argc){
+			height = strtol(argv[++i], &end, 10);
+			if(*end != '\0' || height < NDETECTORS || height%NDETECTORS != 0)
+				usage();
+		}else if(argv[i][0] == '-' || i != argc-1){
+			usage();
+		}else{
+			dir = argv[i];
+		}
+	}
+
+	// smooth fields with some noise, so compression is realistic
+	int n = height*VIIRS_WIDTH;
+	vector<float> lat(n), lon(n);
+	vector<ushort> band(n);
+	srand(1);
+	for(int y = 0; y < height; y++){
+		for(int x = 0; x < VIIRS_WIDTH; x++){
+			int i = y*VIIRS_WIDTH + x;
+			lat[i] = 30 + y*0.0067 + (x - VIIRS_WIDTH/2)*0.0003;
+			lon[i] = -120 + (x - VIIRS_WIDTH/2)*0.007 + y*0.001;
+			double bt = 280 + 10*sin(lat[i]*3) + 5*cos(x*0.003) + (rand()%100)/100.0;
+			band[i] = (ushort)((bt - 200)/0.0025);
+		}
+	}
+
+	printf("%d rows, %d cycles of reading band and geolocation, writing band and attribute\n",
+		height, ncycles);
+	printf("%-12s %-6s %10s %10s %10s\n", "layout", "driver", "MB", "MB/s", "cycles/s");
+	try{
+		for(int l = 0; l < NLAYOUTS; l++){
+			MkFiles m;
+			m.dir = dir;
+			m.layout = l;
+			m.height = height;
+			m.lat = &lat[0];
+			m.lon = &lon[0];
+			m.band = &band[0];
+			io_call(mkfiles, &m);
+			double mb = (filesize(m.geofile) + filesize(m.bandfile))/1e6;
+
+			for(int d = 0; d < (int)nelem(drivers); d++){
+				Status st = viirs_h5driver(drivers[d]);
+				if(st.code != STATUS_OK){
+					eprintf("%s", st.msg);
+				}
+				double bytes = 0, secs = 0;
+				for(int k = 0; k < ncycles; k++){
+					io_call(rmattr, m.bandfile);
+					double t0 = now();
+					bytes += cycle(&m);
+					secs += now() - t0;
+				}
+				printf("%-12s %-6s %10.1f %10.1f %10.2f\n", layoutnames[l], drivers[d],
+					mb, bytes/secs/1e6, ncycles/secs);
+			}
+			remove(m.geofile);
+			remove(m.bandfile);
+		}
+	}catch(const std::exception &e){
+		fprintf(stderr, "%s\n", e.what());
+		exit(2);
+	}
+	return 0;
+}
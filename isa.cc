@@ -0,0 +1,85 @@
+//
+// Selection of the instruction set variant of the resampling kernels
+//
+
+#include <stdio.h>
+#include <string.h>
+#include "viirsresam.h"
+
+static const char *isanames[NISAS] = {
+	"generic",
+	"sse4.2",
+	"avx2",
+	"avx512",
+};
+
+static int curisa = -1;	// set by viirs_isa, or detected on first use
+
+// Best variant the CPU supports.
+static int
+detect()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+	&& __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl"))
+		return ISA_AVX512;
+	if(__builtin_cpu_supports("avx2"))
+		return ISA_AVX2;
+	if(__builtin_cpu_supports("sse4.2"))
+		return ISA_SSE42;
+#endif
+	return ISA_GENERIC;
+}
+
+// Returns the ISA_* variant of the kernels to run.
+int
+isa_current()
+{
+	int isa = __atomic_load_n(&curisa, __ATOMIC_RELAXED);
+
+	if(isa < 0){
+		isa = detect();
+		__atomic_store_n(&curisa, isa, __ATOMIC_RELAXED);
+	}
+	return isa;
+}
+
+const char*
+isa_name(int isa)
+{
+	return isanames[isa];
+}
+
+// Select the instruction set of the resampling kernels: "auto" for
+// the best one the CPU supports (the default), or one of "generic",
+// "sse4.2", "avx2" and "avx512", which the CPU must support. All
+// variants give the same results. Must be called before resampling
+// starts.
+//
+Status
+viirs_isa(const char *name)
+{
+	Status st = {STATUS_OK, ""};
+	int best = detect();
+
+	if(strcmp(name, "auto") == 0){
+		curisa = best;
+		return st;
+	}
+	for(int i = 0; i < NISAS; i++){
+		if(strcmp(name, isanames[i]) != 0)
+			continue;
+		if(i > best){
+			st.code = STATUS_ERROR;
+			snprintf(st.msg, sizeof(st.msg), "instruction set %s not supported by this CPU; best is %s",
+				name, isanames[best]);
+			return st;
+		}
+		curisa = i;
+		return st;
+	}
+	st.code = STATUS_ERROR;
+	snprintf(st.msg, sizeof(st.msg), "unknown instruction set %s; want auto, generic, sse4.2, avx2 or avx512", name);
+	return st;
+}
@@ -0,0 +1,193 @@
+//
+// Totals over all files resampled, written for Prometheus
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "viirsresam.h"
+
+// Upper bounds of the I/O latency histogram buckets, in seconds.
+static const double iobuckets[] = {
+	0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10,
+};
+
+enum {
+	NIOBUCKETS = nelem(iobuckets),
+};
+
+// Updated with atomic adds by the threads resampling files.
+struct Metrics {
+	uvlong	filesok, filesfailed, filesskipped;
+	uvlong	granules;
+	uvlong	bytesread, byteswritten;
+	uvlong	counts[NCOUNTS];
+	uvlong	iobuckets[NIOSTAGES][NIOBUCKETS+1];	// last is +Inf
+	uvlong	iocount[NIOSTAGES];
+	uvlong	ionsec[NIOSTAGES];	// sum of latencies, in nanoseconds
+};
+
+static Metrics metrics;
+static pthread_mutex_t writelock = PTHREAD_MUTEX_INITIALIZER;	// serializes metrics_flush
+static const char *metricspath;	// set by metrics_start
+static int metricsinterval;
+
+static void
+add(uvlong *p, uvlong n)
+{
+	__atomic_fetch_add(p, n, __ATOMIC_RELAXED);
+}
+
+static uvlong
+get(const uvlong *p)
+{
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+// Add file report r, finished with status st, to the totals.
+void
+metrics_file(const Report *r, const Status *st)
+{
+	if(st->code != STATUS_OK)
+		add(&metrics.filesfailed, 1);
+	else if(st->skipped)
+		add(&metrics.filesskipped, 1);
+	else
+		add(&metrics.filesok, 1);
+	add(&metrics.bytesread, r->bytesread);
+	add(&metrics.byteswritten, r->byteswritten);
+	for(int i = 0; i < NCOUNTS; i++){
+		add(&metrics.counts[i], r->counts[i]);
+	}
+}
+
+// Count a granule whose files have all been resampled.
+void
+metrics_granule()
+{
+	add(&metrics.granules, 1);
+}
+
+// Add an I/O stage taking secs to its latency histogram.
+void
+metrics_io(int stage, double secs)
+{
+	int b;
+
+	for(b = 0; b < NIOBUCKETS; b++){
+		if(secs <= iobuckets[b])
+			break;
+	}
+	add(&metrics.iobuckets[stage][b], 1);
+	add(&metrics.iocount[stage], 1);
+	add(&metrics.ionsec[stage], secs*1e9);
+}
+
+static void
+counter(FILE *f, const char *name, const char *help, uvlong v)
+{
+	fprintf(f, "# HELP %s %s\n", name, help);
+	fprintf(f, "# TYPE %s counter\n", name);
+	fprintf(f, "%s %llu\n", name, v);
+}
+
+static void
+writemetrics(FILE *f)
+{
+	fprintf(f, "# HELP viirsresam_files_total Files resampled, by status; skipped if already resampled.\n");
+	fprintf(f, "# TYPE viirsresam_files_total counter\n");
+	fprintf(f, "viirsresam_files_total{status=\"ok\"} %llu\n", get(&metrics.filesok));
+	fprintf(f, "viirsresam_files_total{status=\"failed\"} %llu\n", get(&metrics.filesfailed));
+	fprintf(f, "viirsresam_files_total{status=\"skipped\"} %llu\n", get(&metrics.filesskipped));
+	counter(f, "viirsresam_granules_total", "Granules resampled by --batch or --spool.",
+		get(&metrics.granules));
+	counter(f, "viirsresam_pixels_total", "Pixels resampled and written back.",
+		get(&metrics.counts[COUNT_PIXELS]));
+	counter(f, "viirsresam_bowtie_pixels_filled_total", "Bow-tie deleted pixels filled in.",
+		get(&metrics.counts[COUNT_BOWTIE]));
+	counter(f, "viirsresam_requantize_clamped_total", "Resampled values clamped to the range of the band type.",
+		get(&metrics.counts[COUNT_CLAMPED]));
+	counter(f, "viirsresam_read_bytes_total", "Dataset bytes read.", get(&metrics.bytesread));
+	counter(f, "viirsresam_written_bytes_total", "Dataset bytes written.", get(&metrics.byteswritten));
+
+	fprintf(f, "# HELP viirsresam_io_seconds Latency of HDF5 operations.\n");
+	fprintf(f, "# TYPE viirsresam_io_seconds histogram\n");
+	for(int s = 0; s < NIOSTAGES; s++){
+		const char *op = report_stagename(s);
+		uvlong n = 0;
+		for(int b = 0; b < NIOBUCKETS; b++){
+			n += get(&metrics.iobuckets[s][b]);
+			fprintf(f, "viirsresam_io_seconds_bucket{op=\"%s\",le=\"%g\"} %llu\n", op, iobuckets[b], n);
+		}
+		n += get(&metrics.iobuckets[s][NIOBUCKETS]);
+		fprintf(f, "viirsresam_io_seconds_bucket{op=\"%s\",le=\"+Inf\"} %llu\n", op, n);
+		fprintf(f, "viirsresam_io_seconds_sum{op=\"%s\"} %.9f\n", op, 1e-9*get(&metrics.ionsec[s]));
+		fprintf(f, "viirsresam_io_seconds_count{op=\"%s\"} %llu\n", op, get(&metrics.iocount[s]));
+	}
+}
+
+// Write the metrics to the path given to metrics_start. The file is
+// replaced atomically, so node_exporter never reads a partial file.
+void
+metrics_flush()
+{
+	char tmp[1024];
+
+	if(metricspath == NULL){
+		return;
+	}
+	pthread_mutex_lock(&writelock);
+	snprintf(tmp, sizeof(tmp), "%s.%d.tmp", metricspath, (int)getpid());
+	FILE *f = fopen(tmp, "w");
+	if(f == NULL){
+		fprintf(stderr, "metrics: open %s failed: %s\n", tmp, strerror(errno));
+	}else{
+		writemetrics(f);
+		if(fclose(f) != 0 || rename(tmp, metricspath) != 0){
+			fprintf(stderr, "metrics: write %s failed: %s\n", metricspath, strerror(errno));
+			remove(tmp);
+		}
+	}
+	pthread_mutex_unlock(&writelock);
+}
+
+static void*
+metricsproc(void *arg)
+{
+	for(;;){
+		sleep(metricsinterval);
+		metrics_flush();
+	}
+	return NULL;
+}
+
+// Write the metrics in Prometheus text format to path now and then
+// every interval seconds, for the textfile collector of node_exporter.
+// The path must end in .prom for the collector to read it.
+//
+Status
+metrics_start(const char *path, int interval)
+{
+	Status st = {STATUS_OK, ""};
+	sigset_t all, old;
+	pthread_t tid;
+
+	metricspath = path;
+	metricsinterval = interval;
+	metrics_flush();
+
+	// like the I/O thread, the writer doesn't take the program's signals
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	int err = pthread_create(&tid, NULL, metricsproc, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if(err != 0){
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "cannot start metrics thread: %s", strerror(err));
+		return st;
+	}
+	pthread_detach(tid);
+	return st;
+}
@@ -0,0 +1,132 @@
+//
+// Allocation of image planes
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "viirsresam.h"
+
+enum {
+	PLANEALIGN = 64,	// cache line, and the widest SIMD load
+	HUGEPAGE = 2<<20,
+};
+
+// Huge page modes of viirs_hugepages.
+enum {
+	HUGE_OFF,
+	HUGE_THP,	// transparent huge pages
+	HUGE_EXPLICIT,	// from the hugetlbfs pool, or else transparent
+};
+
+// Header in the PLANEALIGN bytes before a plane.
+struct PlaneHdr {
+	void	*base;	// start of the allocation
+	size_t	len;	// bytes mapped, or 0 if allocated by posix_memalign
+};
+
+static int hugemode = HUGE_THP;
+
+// Map len bytes, a multiple of HUGEPAGE, aligned to HUGEPAGE so
+// that all of it can be backed by huge pages. Returns NULL on error.
+static void*
+maphuge(size_t len)
+{
+	void *p;
+
+	if(hugemode == HUGE_EXPLICIT){
+		p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if(p != MAP_FAILED){
+			return p;
+		}
+		// no huge pages reserved; fall back to transparent ones
+	}
+	size_t maplen = len + HUGEPAGE;
+	char *m = (char*)mmap(NULL, maplen, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(m == MAP_FAILED){
+		return NULL;
+	}
+	char *a = (char*)(((uintptr_t)m + HUGEPAGE-1) & ~(uintptr_t)(HUGEPAGE-1));
+	if(a > m){
+		munmap(m, a - m);
+	}
+	if(m + maplen > a + len){
+		munmap(a + len, m + maplen - (a + len));
+	}
+#ifdef MADV_HUGEPAGE
+	madvise(a, len, MADV_HUGEPAGE);
+#endif
+	return a;
+}
+
+// Allocate an uninitialized plane of n bytes, aligned to 64 bytes.
+// Planes of a megabyte or more are mapped on their own, backed by
+// huge pages as selected by viirs_hugepages. Returns NULL on error.
+// The plane is freed with plane_free.
+//
+void*
+plane_alloc(size_t n)
+{
+	PlaneHdr h;
+	char *base;
+
+	size_t need = n + PLANEALIGN;
+	if(hugemode == HUGE_OFF || need < HUGEPAGE/2){
+		void *p;
+		if(posix_memalign(&p, PLANEALIGN, need) != 0){
+			return NULL;
+		}
+		base = (char*)p;
+		h.len = 0;
+	}else{
+		h.len = (need + HUGEPAGE-1) & ~(size_t)(HUGEPAGE-1);
+		base = (char*)maphuge(h.len);
+		if(base == NULL){
+			return NULL;
+		}
+	}
+	h.base = base;
+	memcpy(base + PLANEALIGN - sizeof(h), &h, sizeof(h));
+	return base + PLANEALIGN;
+}
+
+void
+plane_free(void *p)
+{
+	PlaneHdr h;
+
+	if(p == NULL){
+		return;
+	}
+	memcpy(&h, (char*)p - sizeof(h), sizeof(h));
+	if(h.len == 0){
+		free(h.base);
+	}else{
+		munmap(h.base, h.len);
+	}
+}
+
+// Select how large planes are backed: "off" for normal pages, "thp"
+// for transparent huge pages (the default), or "explicit" for huge
+// pages reserved in vm.nr_hugepages, falling back to transparent
+// ones when none are left. Must be called before resampling starts.
+//
+Status
+viirs_hugepages(const char *mode)
+{
+	Status st = {STATUS_OK, ""};
+
+	if(strcmp(mode, "off") == 0){
+		hugemode = HUGE_OFF;
+	}else if(strcmp(mode, "thp") == 0){
+		hugemode = HUGE_THP;
+	}else if(strcmp(mode, "explicit") == 0){
+		hugemode = HUGE_EXPLICIT;
+	}else{
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "unknown huge page mode %s; want off, thp or explicit", mode);
+	}
+	return st;
+}
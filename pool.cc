@@ -0,0 +1,216 @@
+//
+// Pool of worker threads running jobs from a queue, and bounded queues
+//
+
+#include <pthread.h>
+#include <deque>
+#include "viirsresam.h"
+
+struct Job {
+	void	(*fn)(void *arg);
+	void	*arg;
+};
+
+struct Pool {
+	pthread_mutex_t	lock;
+	pthread_cond_t	work;	// signaled when a job is queued or on exit
+	pthread_cond_t	idle;	// signaled when a job is finished
+	std::deque<Job>	jobs;
+	int	nbusy;	// number of jobs being run
+	bool	exiting;
+	vector<pthread_t>	threads;
+};
+
+static void*
+worker(void *arg)
+{
+	Pool *p = (Pool*)arg;
+
+	pthread_mutex_lock(&p->lock);
+	for(;;){
+		while(p->jobs.empty() && !p->exiting){
+			pthread_cond_wait(&p->work, &p->lock);
+		}
+		if(p->jobs.empty()){	// exiting
+			break;
+		}
+		Job job = p->jobs.front();
+		p->jobs.pop_front();
+		p->nbusy++;
+		pthread_mutex_unlock(&p->lock);
+
+		job.fn(job.arg);
+
+		pthread_mutex_lock(&p->lock);
+		p->nbusy--;
+		pthread_cond_broadcast(&p->idle);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+// Create a pool of nthreads worker threads.
+//
+Pool*
+pool_create(int nthreads)
+{
+	Pool *p = new Pool;
+
+	if(nthreads < 1){
+		nthreads = 1;
+	}
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->work, NULL);
+	pthread_cond_init(&p->idle, NULL);
+	p->nbusy = 0;
+	p->exiting = false;
+	p->threads.resize(nthreads);
+	for(int i = 0; i < nthreads; i++){
+		int n = pthread_create(&p->threads[i], NULL, worker, p);
+		if(n != 0){
+			// run with the threads we got, if any
+			p->threads.resize(i);
+			if(i == 0){
+				pool_destroy(p);
+				errno = n;
+				eprintf("pthread_create failed:");
+			}
+			break;
+		}
+	}
+	return p;
+}
+
+// Queue fn(arg) to be run by one of the worker threads.
+// Fn must not throw.
+//
+void
+pool_submit(Pool *p, void (*fn)(void *arg), void *arg)
+{
+	Job job = {fn, arg};
+
+	pthread_mutex_lock(&p->lock);
+	p->jobs.push_back(job);
+	pthread_cond_signal(&p->work);
+	pthread_mutex_unlock(&p->lock);
+}
+
+// Wait until all the queued jobs have finished.
+//
+void
+pool_wait(Pool *p)
+{
+	pthread_mutex_lock(&p->lock);
+	while(!p->jobs.empty() || p->nbusy > 0){
+		pthread_cond_wait(&p->idle, &p->lock);
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+// Finish the queued jobs, stop the worker threads and free the pool.
+//
+void
+pool_destroy(Pool *p)
+{
+	pthread_mutex_lock(&p->lock);
+	p->exiting = true;
+	pthread_cond_broadcast(&p->work);
+	pthread_mutex_unlock(&p->lock);
+
+	for(int i = 0; i < (int)p->threads.size(); i++){
+		pthread_join(p->threads[i], NULL);
+	}
+	pthread_cond_destroy(&p->idle);
+	pthread_cond_destroy(&p->work);
+	pthread_mutex_destroy(&p->lock);
+	delete p;
+}
+
+struct Queue {
+	pthread_mutex_t	lock;
+	pthread_cond_t	nonempty;
+	pthread_cond_t	nonfull;
+	std::deque<void*>	items;
+	int	cap;	// maximum number of items
+	bool	closed;
+};
+
+// Create a queue holding at most cap items, for passing work
+// between threads. Putting into a full queue blocks, which keeps
+// a fast producer from running ahead of a slow consumer.
+//
+Queue*
+queue_create(int cap)
+{
+	Queue *q = new Queue;
+
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->nonempty, NULL);
+	pthread_cond_init(&q->nonfull, NULL);
+	q->cap = cap < 1 ? 1 : cap;
+	q->closed = false;
+	return q;
+}
+
+// Add v to the end of the queue, waiting while it's full.
+// Returns false, without adding v, if the queue is closed,
+// since nothing may be taking the items out anymore.
+//
+bool
+queue_put(Queue *q, void *v)
+{
+	pthread_mutex_lock(&q->lock);
+	while((int)q->items.size() >= q->cap && !q->closed){
+		pthread_cond_wait(&q->nonfull, &q->lock);
+	}
+	if(q->closed){
+		pthread_mutex_unlock(&q->lock);
+		return false;
+	}
+	q->items.push_back(v);
+	pthread_cond_signal(&q->nonempty);
+	pthread_mutex_unlock(&q->lock);
+	return true;
+}
+
+// Remove the item at the front of the queue, waiting while it's
+// empty. Returns NULL once the queue is closed and empty.
+//
+void*
+queue_get(Queue *q)
+{
+	void *v = NULL;
+
+	pthread_mutex_lock(&q->lock);
+	while(q->items.empty() && !q->closed){
+		pthread_cond_wait(&q->nonempty, &q->lock);
+	}
+	if(!q->items.empty()){
+		v = q->items.front();
+		q->items.pop_front();
+		pthread_cond_signal(&q->nonfull);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return v;
+}
+
+// Mark the end of the items put in the queue.
+//
+void
+queue_close(Queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->closed = true;
+	pthread_cond_broadcast(&q->nonempty);
+	pthread_cond_broadcast(&q->nonfull);
+	pthread_mutex_unlock(&q->lock);
+}
+
+void
+queue_free(Queue *q)
+{
+	pthread_cond_destroy(&q->nonfull);
+	pthread_cond_destroy(&q->nonempty);
+	pthread_mutex_destroy(&q->lock);
+	delete q;
+}
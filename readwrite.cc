@@ -1,8 +1,90 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <hdf5.h>
+#include <vector>
+#include <string.h>
 #include "viirsresam.h"
 
+static hid_t h5fapl = H5P_DEFAULT;	// file access properties for H5Fopen
+
+// H5Fopen with the selected file driver, timed in the report.
+hid_t
+h5open(const char *filename, unsigned flags)
+{
+	Timer t(STAGE_H5OPEN);
+
+	return H5Fopen(filename, flags, h5fapl);
+}
+
+// Close the objects left open in HDF5 files by an error return,
+// which H5close used to take care of, without shutting down the library.
+// Called by the I/O thread after each request.
+void
+h5closeall()
+{
+	ssize_t n = H5Fget_obj_count(H5F_OBJ_ALL, H5F_OBJ_ALL);
+	if(n > 0){
+		std::vector<hid_t> ids(n);
+		n = H5Fget_obj_ids(H5F_OBJ_ALL, H5F_OBJ_ALL, n, &ids[0]);
+		for(ssize_t i = 0; i < n; i++){
+			switch(H5Iget_type(ids[i])){
+			default:
+				break;
+			case H5I_ATTR:
+				H5Aclose(ids[i]);
+				break;
+			case H5I_DATASET:
+				H5Dclose(ids[i]);
+				break;
+			case H5I_DATATYPE:
+				H5Tclose(ids[i]);
+				break;
+			case H5I_GROUP:
+				H5Gclose(ids[i]);
+				break;
+			}
+		}
+		// files last, once nothing in them is open
+		for(ssize_t i = 0; i < n; i++){
+			if(H5Iget_type(ids[i]) == H5I_FILE)
+				H5Fclose(ids[i]);
+		}
+	}
+}
+
+
+// Select rows [row0, row0+*nrows) of the 2D file dataspace, and create the
+// matching memory dataspace in *memspace. If *nrows is 0, all rows are
+// selected and *nrows is set to the number of rows.
+// Returns 0 on success and -1 on error.
+static int
+selectrows(hid_t dataspace, const unsigned long long *dimsizes, int row0, int *nrows, hid_t *memspace)
+{
+	hsize_t start[2], count[2];
+
+	if(*nrows == 0) {
+		row0 = 0;
+		*nrows = dimsizes[0];
+	}
+	if(row0 < 0 || *nrows < 0 || (unsigned long long)(row0 + *nrows) > dimsizes[0]) {
+		printf("Rows %d-%d out of range; dataset has %llu rows\n", row0, row0 + *nrows, dimsizes[0]);
+		return -1;
+	}
+	start[0] = row0;
+	start[1] = 0;
+	count[0] = *nrows;
+	count[1] = dimsizes[1];
+	if(H5Sselect_hyperslab(dataspace, H5S_SELECT_SET, start, NULL, count, NULL) < 0) {
+		printf("Cannot select rows %d-%d!\n", row0, row0 + *nrows);
+		return -1;
+	}
+	*memspace = H5Screate_simple(2, count, NULL);
+	if(*memspace < 0) {
+		printf("Cannot create HDF5 dataspace!\n");
+		return -1;
+	}
+	return 0;
+}
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -32,14 +114,22 @@
 // int                  readwrite   IN        if readwrite == 0, read data
 //                                            if readwrite != 0, write data
 //
+// int                  row0        IN        First row to read/write
+//
+// int                  nrows       IN        Number of rows to read/write starting at row0;
+//                                            if nrows == 0, all rows are read/written and row0 is ignored.
+//                                            dimsizes is always the size of the whole dataset,
+//                                            and buffer holds only the rows read/written.
+//
 // Return value:
 // Upon sucessful completion, the return value is 0; nonzero return value indicates error.
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
-int readwrite_viirs(unsigned short **buffer, unsigned long long * dimsizes, float * gain, float * offset,
-                    char * filename, char * BTstr, int readwrite)
+static int
+h5readwrite_viirs_rows(unsigned short **buffer, unsigned long long * dimsizes, float * gain, float * offset,
+                    const char * filename, const char * BTstr, int readwrite, int row0, int nrows)
 {
 
-	hid_t   file_id, dataset, dataset_factors, dataspace;
+	hid_t   file_id, dataset, dataset_factors, dataspace, memspace;
 	herr_t  hdferr;
 	int     rank_BT, iprint = 0;
 	float   gain_offset[2];
@@ -57,8 +147,8 @@ int readwrite_viirs(unsigned short **buffer, unsigned long long * dimsizes, floa
 		return -1;
 	}
 
-	if(readwrite==0)  file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
-	else              file_id = H5Fopen(filename, H5F_ACC_RDWR,   H5P_DEFAULT);
+	if(readwrite==0)  file_id = h5open(filename, H5F_ACC_RDONLY);
+	else              file_id = h5open(filename, H5F_ACC_RDWR);
 	if(file_id<0) {
 		printf("Cannot open HDF5 file %s!\n", filename);
 		return -1;
@@ -112,21 +202,24 @@ int readwrite_viirs(unsigned short **buffer, unsigned long long * dimsizes, floa
 
 	if(iprint>0) printf("dimsizes = %llu  %llu\n", dimsizes[0], dimsizes[1]);
 
+	if(selectrows(dataspace, dimsizes, row0, &nrows, &memspace) < 0) {
+		return -1;
+	}
 
 	if(readwrite==0) {
-		*buffer = (unsigned short *) malloc(dimsizes[0]*dimsizes[1]*sizeof(unsigned short));
+		*buffer = (unsigned short *) plane_alloc(nrows*dimsizes[1]*sizeof(unsigned short));
 		if(*buffer==NULL) {
 			printf("Cannot allocate memory\n");
 			return -1;
 		}
 
-		hdferr = H5Dread( dataset, H5T_NATIVE_USHORT, H5S_ALL, H5S_ALL, H5P_DEFAULT, *buffer);
+		hdferr = H5Dread( dataset, H5T_NATIVE_USHORT, memspace, dataspace, H5P_DEFAULT, *buffer);
 		if(hdferr<0) {
 			printf("Cannot read data to hdf!\n");
 			return -1;
 		}
 	} else {
-		hdferr = H5Dwrite(dataset, H5T_NATIVE_USHORT, H5S_ALL, H5S_ALL, H5P_DEFAULT, *buffer);
+		hdferr = H5Dwrite(dataset, H5T_NATIVE_USHORT, memspace, dataspace, H5P_DEFAULT, *buffer);
 		if(hdferr<0) {
 			printf("Cannot write data to hdf!\n");
 			return -1;
@@ -134,27 +227,40 @@ int readwrite_viirs(unsigned short **buffer, unsigned long long * dimsizes, floa
 	}
 
 	// close everything
-	hdferr = H5Dclose(dataset);
+	hdferr = H5Sclose(memspace);
 	if(hdferr<0) {
-		printf("Cannot close HDF5 dataset %s!\n", BTstr);
+		printf("Cannot close HDF5 dataspace!\n");
 		return -1;
 	}
 
-	hdferr = H5Fclose(file_id);
+	hdferr = H5Sclose(dataspace);
 	if(hdferr<0) {
-		printf("Cannot close HDF5 file %s!\n", filename);
+		printf("Cannot close HDF5 dataspace for dataset %s!\n", BTstr);
+		return -1;
+	}
+
+	hdferr = H5Dclose(dataset);
+	if(hdferr<0) {
+		printf("Cannot close HDF5 dataset %s!\n", BTstr);
 		return -1;
 	}
 
-	hdferr = H5close();
+	hdferr = H5Fclose(file_id);
 	if(hdferr<0) {
-		printf("Cannot close HDF5 library!\n");
+		printf("Cannot close HDF5 file %s!\n", filename);
 		return -1;
 	}
 
 	return 0;
 };
 
+// Same as readwrite_viirs_rows, for all rows of the dataset.
+int readwrite_viirs(unsigned short **buffer, unsigned long long * dimsizes, float * gain, float * offset,
+                    char * filename, char * BTstr, int readwrite)
+{
+	return readwrite_viirs_rows(buffer, dimsizes, gain, offset, filename, BTstr, readwrite, 0, 0);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -179,13 +285,22 @@ int readwrite_viirs(unsigned short **buffer, unsigned long long * dimsizes, floa
 // int                  readwrite   IN        if readwrite = 0, read data
 //                                            if readwrite != 0, write data
 //
+// int                  row0        IN        First row to read/write
+//
+// int                  nrows       IN        Number of rows to read/write starting at row0;
+//                                            if nrows == 0, all rows are read/written and row0 is ignored.
+//                                            dimsizes is always the size of the whole dataset,
+//                                            and buffer holds only the rows read/written.
+//
 // Return value:
 // Upon sucessful completion, the return value is 0; nonzero return value indicates error.
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
-int readwrite_viirs_float(float **buffer, unsigned long long * dimsizes, const char * filename, const char * BTstr, int readwrite)
+static int
+h5readwrite_viirs_float_rows(float **buffer, unsigned long long * dimsizes, const char * filename, const char * BTstr,
+                    int readwrite, int row0, int nrows)
 {
 
-	hid_t   file_id, dataset, dataspace;
+	hid_t   file_id, dataset, dataspace, memspace;
 	herr_t  hdferr;
 	int     rank_BT, iprint = 0;
 	unsigned long long   maxdimsizes[2];
@@ -198,8 +313,8 @@ int readwrite_viirs_float(float **buffer, unsigned long long * dimsizes, const c
 		return -1;
 	}
 
-	if(readwrite==0)  file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
-	else              file_id = H5Fopen(filename, H5F_ACC_RDWR,   H5P_DEFAULT);
+	if(readwrite==0)  file_id = h5open(filename, H5F_ACC_RDONLY);
+	else              file_id = h5open(filename, H5F_ACC_RDWR);
 	if(file_id<0) {
 		printf("Cannot open HDF5 file %s!\n", filename);
 		return -1;
@@ -231,24 +346,26 @@ int readwrite_viirs_float(float **buffer, unsigned long long * dimsizes, const c
 
 	if(iprint>0) printf("dimsizes = %llu  %llu\n", dimsizes[0], dimsizes[1]);
 
-
+	if(selectrows(dataspace, dimsizes, row0, &nrows, &memspace) < 0) {
+		return -1;
+	}
 
 	if(readwrite==0) {
 
-		*buffer = (float *) malloc(dimsizes[0]*dimsizes[1]*sizeof(float));
+		*buffer = (float *) plane_alloc(nrows*dimsizes[1]*sizeof(float));
 		if(*buffer==NULL) {
 			printf("Cannot allocate memory\n");
 			return -1;
 		}
 
-		hdferr = H5Dread( dataset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, *buffer);
+		hdferr = H5Dread( dataset, H5T_NATIVE_FLOAT, memspace, dataspace, H5P_DEFAULT, *buffer);
 		if(hdferr<0) {
 			printf("Cannot read data from hdf!\n");
 			return -1;
 		}
 	} else {
 
-		hdferr = H5Dwrite(dataset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, *buffer);
+		hdferr = H5Dwrite(dataset, H5T_NATIVE_FLOAT, memspace, dataspace, H5P_DEFAULT, *buffer);
 		if(hdferr<0) {
 			printf("Cannot write data to hdf!\n");
 			return -1;
@@ -257,27 +374,39 @@ int readwrite_viirs_float(float **buffer, unsigned long long * dimsizes, const c
 	}
 
 	// close everything
-	hdferr = H5Dclose(dataset);
+	hdferr = H5Sclose(memspace);
 	if(hdferr<0) {
-		printf("Cannot close HDF5 dataset %s!\n", BTstr);
+		printf("Cannot close HDF5 dataspace!\n");
 		return -1;
 	}
 
-	hdferr = H5Fclose(file_id);
+	hdferr = H5Sclose(dataspace);
 	if(hdferr<0) {
-		printf("Cannot close HDF5 file %s!\n", filename);
+		printf("Cannot close HDF5 dataspace for dataset %s!\n", BTstr);
+		return -1;
+	}
+
+	hdferr = H5Dclose(dataset);
+	if(hdferr<0) {
+		printf("Cannot close HDF5 dataset %s!\n", BTstr);
 		return -1;
 	}
 
-	hdferr = H5close();
+	hdferr = H5Fclose(file_id);
 	if(hdferr<0) {
-		printf("Cannot close HDF5 library!\n");
+		printf("Cannot close HDF5 file %s!\n", filename);
 		return -1;
 	}
 
 	return 0;
 };
 
+// Same as readwrite_viirs_float_rows, for all rows of the dataset.
+int readwrite_viirs_float(float **buffer, unsigned long long * dimsizes, const char * filename, const char * BTstr, int readwrite)
+{
+	return readwrite_viirs_float_rows(buffer, dimsizes, filename, BTstr, readwrite, 0, 0);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -299,7 +428,8 @@ int readwrite_viirs_float(float **buffer, unsigned long long * dimsizes, const c
 //                negative return value indicates error;
 //                positive return value indicates that the attribute was already set.
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-int write_viirs_attribute(const char *filename, const char *attrFieldStr, const char *attrNameStr, float destrval)
+static int
+h5write_viirs_attribute(const char *filename, const char *attrFieldStr, const char *attrNameStr, float destrval)
 {
 
 	hid_t   file_id, dataset;
@@ -312,7 +442,7 @@ int write_viirs_attribute(const char *filename, const char *attrFieldStr, const
 		return -1;
 	}
 
-	file_id = H5Fopen(filename, H5F_ACC_RDWR, H5P_DEFAULT);
+	file_id = h5open(filename, H5F_ACC_RDWR);
 	if(file_id<0) {
 		printf("Cannot open HDF5 file %s!\n", filename);
 		return -1;
@@ -369,11 +499,622 @@ int write_viirs_attribute(const char *filename, const char *attrFieldStr, const
 		return -1;
 	}
 
-	hdferr = H5close();
+	return retval;
+};
+
+// Add rows [row0, row1) to extents, a sorted list of disjoint [row0, row1)
+// pairs, merging the extents it overlaps or touches.
+// Returns whether some of the rows were already in extents.
+static bool
+addrowextent(std::vector<int> &extents, int row0, int row1)
+{
+	std::vector<int> out;
+	bool overlap = false;
+	size_t i = 0;
+
+	for(; i+1 < extents.size() && extents[i+1] < row0; i += 2){
+		out.push_back(extents[i]);
+		out.push_back(extents[i+1]);
+	}
+	for(; i+1 < extents.size() && extents[i] <= row1; i += 2){
+		if(extents[i] < row1 && row0 < extents[i+1]){
+			overlap = true;
+		}
+		row0 = MIN(row0, extents[i]);
+		row1 = MAX(row1, extents[i+1]);
+	}
+	out.push_back(row0);
+	out.push_back(row1);
+	for(; i+1 < extents.size(); i += 2){
+		out.push_back(extents[i]);
+		out.push_back(extents[i+1]);
+	}
+	extents.swap(out);
+	return overlap;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// This subroutine records the extent of resampled rows in an integer attribute
+// for a particular field in a HDF5 file. The attribute holds the [row0, row1) pairs
+// of the rows resampled so far, sorted and disjoint: the new rows are merged with
+// those already recorded, and the attribute is rewritten with their union.
+//
+// Arguments:
+//
+// char *    filename      IN      Name of HDF5 file to which write an attribute
+//
+// char *    attrFieldStr  IN      Name of data field in HDF5 file to which write an attribute
+//
+// char *    attrNameStr   IN      Name of the attribute to write, such as "ResamplingRows"
+//
+// int       row0          IN      First resampled row
+// int       row1          IN      One past the last resampled row
+//
+// Return value:
+// Upon sucessful completion, the return value is nonnegative;
+//                negative return value indicates error;
+//                positive return value indicates that some of the rows were already recorded.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static int
+h5write_viirs_attribute_rows(const char *filename, const char *attrFieldStr, const char *attrNameStr, int row0, int row1)
+{
+
+	hid_t   file_id, dataset;
+	herr_t  hdferr;
+	int     retval = 0;
+	std::vector<int> extents;
+
+	hdferr = H5open();
+	if(hdferr!=0) {
+		printf("Cannot initialize HDF5 library!\n");
+		return -1;
+	}
+
+	file_id = h5open(filename, H5F_ACC_RDWR);
+	if(file_id<0) {
+		printf("Cannot open HDF5 file %s!\n", filename);
+		return -1;
+	}
+
+	dataset = H5Dopen(file_id, attrFieldStr, H5P_DEFAULT);
+	if(dataset<0) {
+		printf("Cannot open HDF5 dataset %s!\n", attrFieldStr);
+		return -1;
+	}
+
+	if(H5Aexists(dataset, attrNameStr)>0) {
+		// attribute already exists, read the rows recorded and delete it
+		hid_t attr_id = H5Aopen(dataset, attrNameStr, H5P_DEFAULT);
+		if(attr_id<0) {
+			printf("Cannot open HDF5 attribute %s\n", attrNameStr);
+			return -1;
+		}
+		hid_t space_id = H5Aget_space(attr_id);
+		hssize_t n = space_id < 0 ? -1 : H5Sget_simple_extent_npoints(space_id);
+		if(n<0 || n%2 != 0) {
+			printf("Bad HDF5 attribute %s\n", attrNameStr);
+			return -1;
+		}
+		extents.resize(n);
+		if(n > 0 && H5Aread(attr_id, H5T_NATIVE_INT, &extents[0]) < 0) {
+			printf("Cannot read attribute!\n");
+			return -1;
+		}
+		H5Sclose(space_id);
+		H5Aclose(attr_id);
+		if(H5Adelete(dataset, attrNameStr) < 0) {
+			printf("Cannot delete attribute!\n");
+			return -1;
+		}
+	}
+	retval = addrowextent(extents, row0, row1);
+
+	hsize_t dims[1] = {extents.size()};
+	hid_t space_id = H5Screate_simple(1, dims, NULL);
+	if(space_id<0)  {
+		printf("Cannot create a new dataspace!\n");
+		return -1;
+	}
+
+	hid_t attr_id = H5Acreate( dataset, attrNameStr, H5T_NATIVE_INT, space_id, H5P_DEFAULT, H5P_DEFAULT);
+	if(attr_id<0) {
+		printf("Cannot create a HDF5 attribute\n");
+		return -1;
+	}
+
+	hdferr = H5Awrite( attr_id, H5T_NATIVE_INT, (const void *) &extents[0] );
+	if(hdferr<0) {
+		printf("Cannot write attribute!\n");
+		return -1;
+	}
+
+	H5Aclose(attr_id);
+	H5Sclose(space_id);
+
+	// close everything
+	hdferr = H5Dclose(dataset);
+	if(hdferr<0) {
+		printf("Cannot close HDF5 dataset %s!\n", attrFieldStr);
+		return -1;
+	}
+
+	hdferr = H5Fclose(file_id);
 	if(hdferr<0) {
-		printf("Cannot close HDF5 library!\n");
+		printf("Cannot close HDF5 file %s!\n", filename);
 		return -1;
 	}
 
 	return retval;
 };
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// This subroutine reads the [row0, row1) pairs of the rows resampled recorded
+// by h5write_viirs_attribute_rows into extents, opening the file read-only.
+//
+// Return value:
+// 1 if the attribute exists, 0 if it doesn't; negative return value indicates error.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static int
+h5read_viirs_attribute_rows(const char *filename, const char *attrFieldStr, const char *attrNameStr,
+	std::vector<int> &extents)
+{
+	hid_t   file_id, dataset;
+	herr_t  hdferr;
+	htri_t  exists;
+
+	extents.clear();
+	hdferr = H5open();
+	if(hdferr!=0) {
+		printf("Cannot initialize HDF5 library!\n");
+		return -1;
+	}
+
+	file_id = h5open(filename, H5F_ACC_RDONLY);
+	if(file_id<0) {
+		printf("Cannot open HDF5 file %s!\n", filename);
+		return -1;
+	}
+
+	dataset = H5Dopen(file_id, attrFieldStr, H5P_DEFAULT);
+	if(dataset<0) {
+		printf("Cannot open HDF5 dataset %s!\n", attrFieldStr);
+		return -1;
+	}
+
+	exists = H5Aexists(dataset, attrNameStr);
+	if(exists<0) {
+		printf("Cannot look up attribute %s!\n", attrNameStr);
+		return -1;
+	}
+	if(exists>0) {
+		hid_t attr_id = H5Aopen(dataset, attrNameStr, H5P_DEFAULT);
+		if(attr_id<0) {
+			printf("Cannot open HDF5 attribute %s\n", attrNameStr);
+			return -1;
+		}
+		hid_t space_id = H5Aget_space(attr_id);
+		hssize_t n = space_id < 0 ? -1 : H5Sget_simple_extent_npoints(space_id);
+		if(n<0 || n%2 != 0) {
+			printf("Bad HDF5 attribute %s\n", attrNameStr);
+			return -1;
+		}
+		extents.resize(n);
+		if(n > 0 && H5Aread(attr_id, H5T_NATIVE_INT, &extents[0]) < 0) {
+			printf("Cannot read attribute!\n");
+			return -1;
+		}
+		H5Sclose(space_id);
+		H5Aclose(attr_id);
+	}
+
+	H5Dclose(dataset);
+	hdferr = H5Fclose(file_id);
+	if(hdferr<0) {
+		printf("Cannot close HDF5 file %s!\n", filename);
+		return -1;
+	}
+
+	return exists > 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// This subroutine deletes an attribute of a particular field in a HDF5 file, if it has it.
+//
+// Return value:
+// 1 if the attribute was deleted, 0 if there was none; negative return value indicates error.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static int
+h5delete_viirs_attribute(const char *filename, const char *attrFieldStr, const char *attrNameStr)
+{
+	hid_t   file_id, dataset;
+	herr_t  hdferr;
+	htri_t  exists;
+
+	hdferr = H5open();
+	if(hdferr!=0) {
+		printf("Cannot initialize HDF5 library!\n");
+		return -1;
+	}
+
+	file_id = h5open(filename, H5F_ACC_RDWR);
+	if(file_id<0) {
+		printf("Cannot open HDF5 file %s!\n", filename);
+		return -1;
+	}
+
+	dataset = H5Dopen(file_id, attrFieldStr, H5P_DEFAULT);
+	if(dataset<0) {
+		printf("Cannot open HDF5 dataset %s!\n", attrFieldStr);
+		return -1;
+	}
+
+	exists = H5Aexists(dataset, attrNameStr);
+	if(exists<0) {
+		printf("Cannot look up attribute %s!\n", attrNameStr);
+		return -1;
+	}
+	if(exists>0 && H5Adelete(dataset, attrNameStr)<0) {
+		printf("Cannot delete attribute %s!\n", attrNameStr);
+		return -1;
+	}
+
+	H5Dclose(dataset);
+	hdferr = H5Fclose(file_id);
+	if(hdferr<0) {
+		printf("Cannot close HDF5 file %s!\n", filename);
+		return -1;
+	}
+
+	return exists > 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// This subroutine tells whether a particular field in a HDF5 file has an attribute,
+// opening the file read-only and without reading any data.
+//
+// Return value:
+// 1 if the attribute exists, 0 if it doesn't; negative return value indicates error.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static int
+h5viirs_attribute_exists(const char *filename, const char *attrFieldStr, const char *attrNameStr)
+{
+	hid_t   file_id, dataset;
+	herr_t  hdferr;
+	htri_t  exists;
+
+	hdferr = H5open();
+	if(hdferr!=0) {
+		printf("Cannot initialize HDF5 library!\n");
+		return -1;
+	}
+
+	file_id = h5open(filename, H5F_ACC_RDONLY);
+	if(file_id<0) {
+		printf("Cannot open HDF5 file %s!\n", filename);
+		return -1;
+	}
+
+	dataset = H5Dopen(file_id, attrFieldStr, H5P_DEFAULT);
+	if(dataset<0) {
+		printf("Cannot open HDF5 dataset %s!\n", attrFieldStr);
+		return -1;
+	}
+
+	exists = H5Aexists(dataset, attrNameStr);
+	if(exists<0) {
+		printf("Cannot look up attribute %s!\n", attrNameStr);
+		return -1;
+	}
+
+	H5Dclose(dataset);
+	hdferr = H5Fclose(file_id);
+	if(hdferr<0) {
+		printf("Cannot close HDF5 file %s!\n", filename);
+		return -1;
+	}
+
+	return exists > 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// This subroutine returns the dimensions of a 2D dataset in a HDF5 file without reading it.
+//
+// Return value:
+// Upon sucessful completion, the return value is 0; nonzero return value indicates error.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static int
+h5viirs_dimsizes(const char *filename, const char *BTstr, unsigned long long *dimsizes)
+{
+	hid_t   file_id, dataset, dataspace;
+	herr_t  hdferr;
+	int     rank;
+	unsigned long long   maxdimsizes[2];
+
+	hdferr = H5open();
+	if(hdferr!=0) {
+		printf("Cannot initialize HDF5 library!\n");
+		return -1;
+	}
+
+	file_id = h5open(filename, H5F_ACC_RDONLY);
+	if(file_id<0) {
+		printf("Cannot open HDF5 file %s!\n", filename);
+		return -1;
+	}
+
+	dataset = H5Dopen(file_id, BTstr, H5P_DEFAULT);
+	if(dataset<0) {
+		printf("Cannot open HDF5 dataset %s!\n", BTstr);
+		return -1;
+	}
+
+	dataspace = H5Dget_space(dataset);
+	if(dataspace<0) {
+		printf("Cannot open HDF5 dataspace for dataset %s!\n", BTstr);
+		return -1;
+	}
+
+	rank = H5Sget_simple_extent_ndims(dataspace);
+	if(rank!=2) {
+		printf("Unexpected rank of dataspace %i expected 2\n", rank);
+		return -1;
+	}
+
+	rank = H5Sget_simple_extent_dims(dataspace, dimsizes, maxdimsizes);
+	if(rank<0)  {
+		printf("Cannot get dataspace dimensions!\n");
+		return -1;
+	}
+
+	H5Sclose(dataspace);
+	H5Dclose(dataset);
+	hdferr = H5Fclose(file_id);
+	if(hdferr<0) {
+		printf("Cannot close HDF5 file %s!\n", filename);
+		return -1;
+	}
+
+	return 0;
+};
+
+// The functions below run the ones above on the I/O thread (io.cc),
+// which makes all HDF5 calls.
+
+// Count the bytes of nrows rows (all if 0) of a dataset of
+// size dimsizes read or written in the report.
+static void
+countbytes(const unsigned long long *dimsizes, int nrows, size_t elemsize, int readwrite)
+{
+	double n = (double)(nrows > 0 ? nrows : dimsizes[0])*dimsizes[1]*elemsize;
+
+	if(readwrite){
+		report_bytes(0, n);
+	}else{
+		report_bytes(n, 0);
+	}
+}
+
+struct RowsReq {
+	unsigned short	**buffer;
+	unsigned long long	*dimsizes;
+	float	*gain, *offset;
+	const char	*filename, *BTstr;
+	int	readwrite, row0, nrows;
+	int	ret;
+};
+
+static void
+rowsreq(void *arg)
+{
+	RowsReq *r = (RowsReq*)arg;
+	Timer t(r->readwrite ? STAGE_H5WRITE : STAGE_H5READ);
+
+	r->ret = h5readwrite_viirs_rows(r->buffer, r->dimsizes, r->gain, r->offset,
+		r->filename, r->BTstr, r->readwrite, r->row0, r->nrows);
+	if(r->ret == 0){
+		countbytes(r->dimsizes, r->nrows, sizeof(**r->buffer), r->readwrite);
+	}
+}
+
+int
+readwrite_viirs_rows(unsigned short **buffer, unsigned long long *dimsizes, float *gain, float *offset,
+	const char *filename, const char *BTstr, int readwrite, int row0, int nrows)
+{
+	RowsReq r = {buffer, dimsizes, gain, offset, filename, BTstr, readwrite, row0, nrows, -1};
+	io_call(rowsreq, &r);
+	return r.ret;
+}
+
+struct FloatRowsReq {
+	float	**buffer;
+	unsigned long long	*dimsizes;
+	const char	*filename, *BTstr;
+	int	readwrite, row0, nrows;
+	int	ret;
+};
+
+static void
+floatrowsreq(void *arg)
+{
+	FloatRowsReq *r = (FloatRowsReq*)arg;
+	Timer t(r->readwrite ? STAGE_H5WRITE : STAGE_H5READ);
+
+	r->ret = h5readwrite_viirs_float_rows(r->buffer, r->dimsizes, r->filename, r->BTstr,
+		r->readwrite, r->row0, r->nrows);
+	if(r->ret == 0){
+		countbytes(r->dimsizes, r->nrows, sizeof(**r->buffer), r->readwrite);
+	}
+}
+
+int
+readwrite_viirs_float_rows(float **buffer, unsigned long long *dimsizes, const char *filename, const char *BTstr,
+	int readwrite, int row0, int nrows)
+{
+	FloatRowsReq r = {buffer, dimsizes, filename, BTstr, readwrite, row0, nrows, -1};
+	io_call(floatrowsreq, &r);
+	return r.ret;
+}
+
+struct AttrReq {
+	const char	*filename, *attrFieldStr, *attrNameStr;
+	float	destrval;	// for write_viirs_attribute
+	int	row0, row1;	// for write_viirs_attribute_rows
+	int	ret;
+	std::vector<int>	*extents;	// for read_viirs_attribute_rows
+};
+
+static void
+attrreq(void *arg)
+{
+	AttrReq *r = (AttrReq*)arg;
+	Timer t(STAGE_ATTR);
+
+	r->ret = h5write_viirs_attribute(r->filename, r->attrFieldStr, r->attrNameStr, r->destrval);
+}
+
+int
+write_viirs_attribute(const char *filename, const char *attrFieldStr, const char *attrNameStr, float destrval)
+{
+	AttrReq r = {filename, attrFieldStr, attrNameStr, destrval, 0, 0, -1};
+	io_call(attrreq, &r);
+	return r.ret;
+}
+
+static void
+attrrowsreq(void *arg)
+{
+	AttrReq *r = (AttrReq*)arg;
+	Timer t(STAGE_ATTR);
+
+	r->ret = h5write_viirs_attribute_rows(r->filename, r->attrFieldStr, r->attrNameStr, r->row0, r->row1);
+}
+
+int
+write_viirs_attribute_rows(const char *filename, const char *attrFieldStr, const char *attrNameStr, int row0, int row1)
+{
+	AttrReq r = {filename, attrFieldStr, attrNameStr, 0, row0, row1, -1};
+	io_call(attrrowsreq, &r);
+	return r.ret;
+}
+
+static void
+attrreadrowsreq(void *arg)
+{
+	AttrReq *r = (AttrReq*)arg;
+	Timer t(STAGE_ATTR);
+
+	r->ret = h5read_viirs_attribute_rows(r->filename, r->attrFieldStr, r->attrNameStr, *r->extents);
+}
+
+int
+read_viirs_attribute_rows(const char *filename, const char *attrFieldStr, const char *attrNameStr,
+	std::vector<int> &extents)
+{
+	AttrReq r = {filename, attrFieldStr, attrNameStr, 0, 0, 0, -1, &extents};
+	io_call(attrreadrowsreq, &r);
+	return r.ret;
+}
+
+static void
+attrdeletereq(void *arg)
+{
+	AttrReq *r = (AttrReq*)arg;
+	Timer t(STAGE_ATTR);
+
+	r->ret = h5delete_viirs_attribute(r->filename, r->attrFieldStr, r->attrNameStr);
+}
+
+int
+delete_viirs_attribute(const char *filename, const char *attrFieldStr, const char *attrNameStr)
+{
+	AttrReq r = {filename, attrFieldStr, attrNameStr, 0, 0, 0, -1};
+	io_call(attrdeletereq, &r);
+	return r.ret;
+}
+
+static void
+attrexistsreq(void *arg)
+{
+	AttrReq *r = (AttrReq*)arg;
+	Timer t(STAGE_ATTR);
+
+	r->ret = h5viirs_attribute_exists(r->filename, r->attrFieldStr, r->attrNameStr);
+}
+
+int
+viirs_attribute_exists(const char *filename, const char *attrFieldStr, const char *attrNameStr)
+{
+	AttrReq r = {filename, attrFieldStr, attrNameStr, 0, 0, 0, -1};
+	io_call(attrexistsreq, &r);
+	return r.ret;
+}
+
+struct DimsReq {
+	const char	*filename, *BTstr;
+	unsigned long long	*dimsizes;
+	int	ret;
+};
+
+static void
+dimsreq(void *arg)
+{
+	DimsReq *r = (DimsReq*)arg;
+	Timer t(STAGE_H5READ);
+
+	r->ret = h5viirs_dimsizes(r->filename, r->BTstr, r->dimsizes);
+}
+
+int
+viirs_dimsizes(const char *filename, const char *BTstr, unsigned long long *dimsizes)
+{
+	DimsReq r = {filename, BTstr, dimsizes, -1};
+	io_call(dimsreq, &r);
+	return r.ret;
+}
+
+static void
+driverreq(void *arg)
+{
+	const char *name = *(const char**)arg;
+	hid_t fapl;
+
+	fapl = H5Pcreate(H5P_FILE_ACCESS);
+	if(fapl < 0){
+		eprintf("cannot create HDF5 file access properties");
+	}
+	herr_t err = -1;
+	if(strcmp(name, "sec2") == 0){
+		err = H5Pset_fapl_sec2(fapl);
+	}else if(strcmp(name, "stdio") == 0){
+		err = H5Pset_fapl_stdio(fapl);
+	}else if(strcmp(name, "core") == 0){
+		// whole file in memory, written back on close
+		err = H5Pset_fapl_core(fapl, 1<<20, 1);
+	}
+	if(err < 0){
+		H5Pclose(fapl);
+		eprintf("unknown HDF5 file driver %s", name);
+	}
+	if(h5fapl != H5P_DEFAULT){
+		H5Pclose(h5fapl);
+	}
+	h5fapl = fapl;
+}
+
+// Open the HDF5 files with file driver name, "sec2" (the default),
+// "core" or "stdio", from now on.
+Status
+viirs_h5driver(const char *name)
+{
+	Status st = {STATUS_OK, ""};
+
+	try{
+		io_call(driverreq, &name);
+	}catch(const std::exception &e){
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "%s", e.what());
+	}
+	return st;
+}
@@ -4,19 +4,21 @@ enum {
 	MAXDIMS = 5,
 };
 
-// Print out error for NetCDF error number n and exit the program.
+// Throw an Error for NetCDF error number n.
 void
 ncfatal(int n, const char *fmt, ...)
 {
 	va_list args;
+	Error e;
+	int len;
 
-	fflush(stdout);
 	va_start(args, fmt);
-	vfprintf(stderr, fmt, args);
+	len = vsnprintf(e.msg, sizeof(e.msg), fmt, args);
 	va_end(args);
 
-	fprintf(stderr, ": %s\n", nc_strerror(n));
-	exit(2);
+	if(len >= 0 && len < (int)sizeof(e.msg))
+		snprintf(e.msg+len, sizeof(e.msg)-len, ": %s", nc_strerror(n));
+	throw e;
 }
 
 float
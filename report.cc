@@ -0,0 +1,186 @@
+//
+// Timing and I/O statistics of the files resampled
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "viirsresam.h"
+
+static const char *stagenames[NSTAGES] = {
+	"h5open",
+	"h5read",
+	"h5write",
+	"attrwrite",
+	"convert",
+	"sortind",
+	"sort",
+	"resample",
+	"requantize",
+	"fused",
+	"grid",
+};
+
+static __thread Report *curreport;	// report of the file this thread is working on
+static __thread Timer *curtimer;	// innermost running timer
+static pthread_mutex_t reportlock = PTHREAD_MUTEX_INITIALIZER;	// serializes writing records
+
+static double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+// Clear report r and start its clock.
+void
+report_init(Report *r)
+{
+	memset(r, 0, sizeof(*r));
+	r->t0 = now();
+}
+
+// Make r the report of the file this thread is working on, until
+// the scope ends. R may be NULL.
+ReportScope::ReportScope(Report *r)
+{
+	old = curreport;
+	curreport = r;
+}
+
+ReportScope::~ReportScope()
+{
+	curreport = old;
+}
+
+Report*
+report_current()
+{
+	return curreport;
+}
+
+const char*
+report_stagename(int stage)
+{
+	return stagenames[stage];
+}
+
+// Time the scope as stage of the current report, if there is one.
+// Time spent in nested timers is counted only for their stage.
+// The I/O stages are also timed without a report, for the metrics.
+Timer::Timer(int s)
+{
+	rep = curreport;
+	stage = s;
+	on = rep != NULL || stage < NIOSTAGES;
+	if(!on){
+		return;
+	}
+	child = 0;
+	parent = curtimer;
+	curtimer = this;
+	t0 = now();
+}
+
+Timer::~Timer()
+{
+	if(!on){
+		return;
+	}
+	double t = now() - t0;
+	if(rep != NULL){
+		rep->secs[stage] += t - child;
+	}
+	if(parent != NULL){
+		parent->child += t;
+	}
+	curtimer = parent;
+	if(stage < NIOSTAGES){
+		metrics_io(stage, t);
+	}
+}
+
+// Count bytes read from and written to files in the current report.
+void
+report_bytes(double nread, double nwritten)
+{
+	if(curreport != NULL){
+		curreport->bytesread += nread;
+		curreport->byteswritten += nwritten;
+	}
+}
+
+// Add n to count c of the current report.
+void
+report_count(int c, double n)
+{
+	if(curreport != NULL){
+		curreport->counts[c] += n;
+	}
+}
+
+static void
+jsonstr(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for(; *s != '\0'; s++){
+		if(*s == '"' || *s == '\\'){
+			fprintf(f, "\\%c", *s);
+		}else if((unsigned char)*s < ' '){
+			fprintf(f, "\\u%04x", *s);
+		}else{
+			fputc(*s, f);
+		}
+	}
+	fputc('"', f);
+}
+
+// Write report r of file (resampled with geofile, which may be NULL),
+// finished with status st, as a line of JSON to f. The peak RSS is
+// that of the whole process so far.
+//
+static void
+report_write(FILE *f, const Report *r, const char *geofile, const char *file, const Status *st)
+{
+	struct rusage ru;
+
+	double secs = now() - r->t0;
+	getrusage(RUSAGE_SELF, &ru);
+
+	pthread_mutex_lock(&reportlock);
+	fprintf(f, "{\"file\": ");
+	jsonstr(f, file);
+	fprintf(f, ", \"geofile\": ");
+	if(geofile != NULL){
+		jsonstr(f, geofile);
+	}else{
+		fprintf(f, "null");
+	}
+	fprintf(f, ", \"status\": \"%s\", \"error\": ",
+		st->code != STATUS_OK ? "FAIL" : st->skipped ? "skip" : "ok");
+	jsonstr(f, st->msg);
+	fprintf(f, ", \"seconds\": %.6f, \"stages\": {", secs);
+	for(int i = 0; i < NSTAGES; i++){
+		fprintf(f, "%s\"%s\": %.6f", i > 0 ? ", " : "", stagenames[i], r->secs[i]);
+	}
+	fprintf(f, "}, \"bytes_read\": %.0f, \"bytes_written\": %.0f, \"pixels\": %.0f, \"bowtie_filled\": %.0f, \"clamped\": %.0f, \"peak_rss_kb\": %ld}\n",
+		r->bytesread, r->byteswritten, r->counts[COUNT_PIXELS], r->counts[COUNT_BOWTIE],
+		r->counts[COUNT_CLAMPED], ru.ru_maxrss);
+	fflush(f);
+	pthread_mutex_unlock(&reportlock);
+}
+
+// Finish report r of file: add it to the metrics, and write
+// it to f if f is not NULL.
+void
+report_end(FILE *f, const Report *r, const char *geofile, const char *file, const Status *st)
+{
+	metrics_file(r, st);
+	if(f != NULL){
+		report_write(f, r, geofile, file, st);
+	}
+}
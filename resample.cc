@@ -8,7 +8,7 @@
 // Pixels in deletion zone are given this value.
 // It's -999.0 for band 13, and scaled value of integer 65533 for other bands,
 // but those values are set to NAN in main function.
-float DELETION_ZONE_VALUE = NAN;
+const float DELETION_ZONE_VALUE = NAN;
 
 inline bool
 isinvalid(float x)
@@ -114,7 +114,7 @@ adjustbreakpoints(const Mat &slat, Mat &breakpointsT)
 void
 getsortingind(Mat &sind, int height)
 {
-	sind = Mat::zeros(height, VIIRS_WIDTH, CV_32SC1);
+	sind.create(height, VIIRS_WIDTH, CV_32SC1);	// every element is set below
 	
 	int x = 0;
 	for(int i = 0; i < NCOLUMN_BREAKS; i++){
@@ -151,7 +151,7 @@ getsortingind(Mat &sind, int height)
 
 static inline void
 getsortingind_left(Mat &sind, int startrow, int endrow, const Mat &breakpoints,
-	short offset[][NCOLUMN_BREAKS])
+	const short offset[][NCOLUMN_BREAKS])
 {
 	for(int y = startrow; y < endrow; y++){
 		int x = 0;
@@ -167,7 +167,7 @@ getsortingind_left(Mat &sind, int startrow, int endrow, const Mat &breakpoints,
 
 static inline void
 getsortingind_right(Mat &sind, int startrow, int endrow, const Mat &breakpoints,
-	short offset[][NCOLUMN_BREAKS])
+	const short offset[][NCOLUMN_BREAKS])
 {
 	for(int y = startrow; y < endrow; y++){
 		int x = VIIRS_WIDTH-1;
@@ -207,21 +207,27 @@ getsortingind1(Mat &sind, int height, const Mat &leftbreaks, const Mat &rightbre
 void
 getadjustedsortingind(Mat &sind, const Mat &lat)
 {
-	Mat _sind, leftbreaks, rightbreaks;
+	Timer t(STAGE_SORTIND);
+	WsScope ws;
+	Mat leftbreaks, rightbreaks;
 	
 	int ny = lat.rows;
 	
+	Mat _sind = wsmat(ny, VIIRS_WIDTH, CV_32SC1);
 	getsortingind(_sind, ny);
-	sind = Mat::zeros(ny, VIIRS_WIDTH, CV_32SC1);
+	// every element is set by getsortingind1, as the terminating
+	// break point is never adjusted
+	sind.create(ny, VIIRS_WIDTH, CV_32SC1);
 
 	if(true){	// adjusted breaking points
-		Mat _slat = resample_sort(_sind, lat);
+		Mat _slat = wsmat(lat.rows, lat.cols, lat.type());
+		resample_sort(_sind, lat, _slat);
 		
 		// left half
 		adjustbreakpoints(_slat, leftbreaks);
 		
 		// right half
-		Mat slatflipped = Mat::zeros(_slat.size(), _slat.type());
+		Mat slatflipped = wsmat(_slat.rows, _slat.cols, _slat.type());
 		flip(_slat, slatflipped, 1);
 		adjustbreakpoints(slatflipped, rightbreaks);
 		
@@ -286,10 +292,9 @@ resample_unsort(const Mat &sind, const Mat &img)
 }
 
 template <class T>
-static Mat
-resample_sort_(const Mat &sind, const Mat &img)
+static void
+resample_sort_(const Mat &sind, const Mat &img, Mat &newimg)
 {
-	Mat newimg;
 	int i, j, k;
 	int32_t *sp;
 	T *np;
@@ -297,7 +302,8 @@ resample_sort_(const Mat &sind, const Mat &img)
 	CHECKMAT(sind, CV_32SC1);
 	CV_Assert(img.channels() == 1);
 
-	newimg = Mat::zeros(img.rows, img.cols, img.type());
+	newimg.create(img.rows, img.cols, img.type());	// every element is set below
+	CV_Assert(newimg.isContinuous());
 	sp = (int*)sind.data;
 	np = (T*)newimg.data;
 	k = 0;
@@ -307,36 +313,46 @@ resample_sort_(const Mat &sind, const Mat &img)
 			k++;
 		}
 	}
-	return newimg;
 }
 
-// Returns the sorted image of the unsorted image img.
+// Sort the unsorted image img into dst, which is reallocated
+// unless it already has the size and type of img.
 // Sind is the image of sort indices.
-Mat
-resample_sort(const Mat &sind, const Mat &img)
+void
+resample_sort(const Mat &sind, const Mat &img, Mat &dst)
 {
+	Timer t(STAGE_SORT);
 	switch(img.type()) {
 	default:
 		eprintf("resample_sort: unsupported type %s\n", type2str(img.type()));
 		break;
 	case CV_8UC1:
-		return resample_sort_<uchar>(sind, img);
+		resample_sort_<uchar>(sind, img, dst);
 		break;
 	case CV_16SC1:
-		return resample_sort_<short>(sind, img);
+		resample_sort_<short>(sind, img, dst);
 		break;
 	case CV_16UC1:
-		return resample_sort_<ushort>(sind, img);
+		resample_sort_<ushort>(sind, img, dst);
 		break;
 	case CV_32FC1:
-		return resample_sort_<float>(sind, img);
+		resample_sort_<float>(sind, img, dst);
 		break;
 	case CV_64FC1:
-		return resample_sort_<double>(sind, img);
+		resample_sort_<double>(sind, img, dst);
 		break;
 	}
-	// not reached
-	return Mat();
+}
+
+// Returns the sorted image of the unsorted image img.
+// Sind is the image of sort indices.
+Mat
+resample_sort(const Mat &sind, const Mat &img)
+{
+	Mat dst;
+
+	resample_sort(sind, img, dst);
+	return dst;
 }
 
 // Find distance between (lat1, lon1) and (lat2, lon2).
@@ -361,6 +377,13 @@ geodist(double lat1, double lon1, double lat2, double lon2)
 	return R*sqrt(SQ(cos((phi1+phi2)/2) * delta_lam) + SQ(delta_phi));
 }
 
+// Whether lat and lon are a location, and not fill values.
+bool
+validgeo(float lat, float lon)
+{
+	return fabs(lat) <= 90 && fabs(lon) <= 180;
+}
+
 // Approximate from three (possibly invalid) values at lat/lon pairs.
 //
 // T -- 3 SST values
@@ -400,20 +423,73 @@ geoapprox(const float *T, const float *lat, const float *lon, float targlat, flo
 	return num/denom;
 }
 
+// Compute the Gaussian weights of three lat/lon points for the target
+// latitude targlat and longitude targlon, at spatial resolution res.
+// The weights are returned in w.
+//
+static inline void
+geoweights(const float *lat, const float *lon, float targlat, float targlon, double res, double *w)
+{
+	double sqres = SQ(res);
+	for(int i = 0; i < 3; i++){
+		double d = geodist(targlat, targlon, lat[i], lon[i]);
+		w[i] = exp(-SQ(d) / sqres);
+	}
+}
+
+// Same as geoapprox, but with precomputed weights w from geoweights.
+//
+static inline double
+geoapproxw(const float *T, const double *w)
+{
+	// none valid
+	if(isinvalid(T[0]) && isinvalid(T[1]) && isinvalid(T[2]))
+		return DELETION_ZONE_VALUE;
+
+	// one valid
+	if(isinvalid(T[0]) && isinvalid(T[1]))
+		return T[2];
+	if(isinvalid(T[0]) && isinvalid(T[2]))
+		return T[1];
+	if(isinvalid(T[1]) && isinvalid(T[2]))
+		return T[0];
+	
+	// at least two valid
+	double num = 0;
+	double denom = 0;
+	for(int i = 0; i < 3; i++){
+		if(!isinvalid(T[i])){
+			num += T[i] * w[i];
+			denom += w[i];
+		}
+	}
+	return num/denom;
+}
+
+// Unit vector (c, s) of longitude lon given in degrees.
+//
+static inline void
+lonvec(double lon, double *c, double *s)
+{
+	sincos(RADIANCE(lon), s, c);
+}
+
 // Linear interpolation at x between points (x0, y0) and (x1, y1).
-// y0 and y1 are logitudes given in radiance.
-// Returned interpolated value is also in radiance.
+// y0 and y1 are logitudes given as unit vectors (c0, s0) and (c1, s1).
+// Returned interpolated value is in degrees.
 //
-inline double
-linearinterp(double x0, double y0, double x1, double y1, double x)
+static inline double
+linearinterp(double x0, double c0, double s0, double x1, double c1, double s1, double x)
 {
 	double lam = (x - x0)/(x1 - x0);
 	double lam1 = 1-lam;
-	return atan2(lam1*sin(y0) + lam*sin(y1), lam1*cos(y0) + lam*cos(y1));
+	return DEGREE(atan2(lam1*s0 + lam*s1, lam1*c0 + lam*c1));
 }
 
 // Interpolate longitude based on latitude sorting order.
 // This makes the longitude monotonic.
+// Longitudes are interpolated as unit vectors, so only the kept order
+// points need sin/cos, and each reordered point needs one atan2.
 //
 // sind -- latitude sorting indices
 // slon -- sorted longitude
@@ -442,38 +518,49 @@ interplon(const int *sind, const float *slon, const float *lon, int n, float *ds
 	}
 	buf.clear();
 	double prevkeep = i;
-	double prevlon = RADIANCE(slon[i]);
+	double prevc, prevs;
+	lonvec(slon[i], &prevc, &prevs);
 	
 	// interpolate reordered points
 	for(; i < n; i++){
 		// sneak in middle of swath (between middle two detectors)
 		if(i%NDETECTORS == NDETECTORS/2){
 			double curkeep = i-0.5;
-			double phi1 = RADIANCE(lon[i]);
-			double phi2 = RADIANCE(lon[i-1]);
-			double curlon = atan2((sin(phi1) + sin(phi2))/2.0, (cos(phi1) + cos(phi2))/2.0);
+			double c1, s1, c2, s2;
+			lonvec(lon[i], &c1, &s1);
+			lonvec(lon[i-1], &c2, &s2);
+			double curc = (c1 + c2)/2.0;
+			double curs = (s1 + s2)/2.0;
+			double h = hypot(curc, curs);
+			curc /= h;
+			curs /= h;
 			
 			// interpolate at points in the buffer and clear the buffer
 			for(int j = 0; j < (int)buf.size(); j++){
 				int k = buf[j];
-				dst[k] = DEGREE(linearinterp(prevkeep, prevlon, curkeep, curlon, k));
+				dst[k] = linearinterp(prevkeep, prevc, prevs, curkeep, curc, curs, k);
 			}
 			buf.clear();
 			
 			prevkeep = curkeep;
-			prevlon = curlon;
+			prevc = curc;
+			prevs = curs;
 		}
 		
 		if(sind[i] == i){	// kept order
+			double c, s;
+			lonvec(slon[i], &c, &s);
+
 			// interpolate at points in the buffer and clear the buffer
 			for(int j = 0; j < (int)buf.size(); j++){
 				int k = buf[j];
-				dst[k] = DEGREE(linearinterp(prevkeep, prevlon, i, RADIANCE(slon[i]), k));
+				dst[k] = linearinterp(prevkeep, prevc, prevs, i, c, s, k);
 			}
 			buf.clear();
 			
 			prevkeep = i;
-			prevlon = RADIANCE(slon[i]);
+			prevc = c;
+			prevs = s;
 			dst[i] = slon[i];
 		}else{	// reordered
 			buf.push_back(i);
@@ -481,65 +568,103 @@ interplon(const int *sind, const float *slon, const float *lon, int n, float *ds
 	}
 	
 	// extrapolate the reordered points after the last "kept order" point
-	for(int j = 0; j < (int)buf.size(); j++){
-		dst[buf[j]] = DEGREE(prevlon);
+	if(buf.size() > 0){
+		double last = DEGREE(atan2(prevs, prevc));
+		for(int j = 0; j < (int)buf.size(); j++){
+			dst[buf[j]] = last;
+		}
 	}
 }
 
-// Resample 1D data.
+// Spatial resolution used for resampling column j of an image
+// with the given width.
+//
+static inline double
+columnres(int j, int width)
+{
+	double x = 2*j/(double)width - 1.0;
+	return 0.1*SQ(x) + 0.1;
+}
+
+// Resample 1D data of nch channels sharing the same geolocation.
+// The weights are computed once per element and applied to all channels.
 //
 // sind -- sorting indices
-// sval -- sorted values
+// sval -- sorted values for each channel
+// nch -- number of channels
 // slat -- sorted latitude
 // slon -- sorted longitude
 // ilon -- interpolated longitude
 // n -- number of elements
 // res -- spatial resolution
-// rval -- resampled values (output)
+// gaponly -- only interpolate reordered and invalid values; copy the rest
+// rval -- resampled values for each channel (output)
 //
-static void
-resample1d(const int *sind, const float *sval, const float *slat, const float *slon,
-	const float *ilon, int n, double res, float *rval)
+static ALWAYS_INLINE void
+resample1d_(const int *sind, const float *const *sval, int nch, const float *slat, const float *slon,
+	const float *ilon, int n, double res, bool gaponly, float *const *rval)
 {
-	int i;
+	int i, c;
+	double w[3];
+	bool haveweights;
 	
 	// Interpolate the middle values.
 	// Set first and last values to an invalid value for now
 	// because interpolation requires 3 consecutive values.
-	rval[0] = sval[0];
+	for(c = 0; c < nch; c++){
+		rval[c][0] = sval[c][0];
+	}
 	for(i = 1; i < n-1; i++){
-		//if(sind[i] == i){	// kept order
-		//	rval[i] = sval[i];
-		//}else{	// reordered
-		//	rval[i] = geoapprox(&sval[i-1], &slat[i-1], &slon[i-1], slat[i], ilon[i], res);
-		//}
-		rval[i] = geoapprox(&sval[i-1], &slat[i-1], &slon[i-1], slat[i], ilon[i], res);
+		haveweights = false;
+		for(c = 0; c < nch; c++){
+			if(gaponly && sind[i] == i && !isnan(sval[c][i])){	// kept order
+				rval[c][i] = sval[c][i];
+				continue;
+			}
+			if(!haveweights){
+				geoweights(&slat[i-1], &slon[i-1], slat[i], ilon[i], res, w);
+				haveweights = true;
+			}
+			rval[c][i] = geoapproxw(&sval[c][i-1], w);
+		}
+	}
+	for(c = 0; c < nch; c++){
+		rval[c][n-1] = sval[c][n-1];
 	}
-	rval[n-1] = sval[n-1];
 }
 
-// Resample a 2D image.
+ISA_KERNEL(resample1d, (const int *sind, const float *const *sval, int nch, const float *slat,
+	const float *slon, const float *ilon, int n, double res, bool gaponly, float *const *rval),
+	(sind, sval, nch, slat, slon, ilon, n, res, gaponly, rval))
+
+// Resample a 2D image of one or more channels.
 //
 // sortidx -- latitude sorting indices
-// ssrc -- image to resample already sorted
+// ssrc -- image channels to resample already sorted
 // slat -- sorted latitude
 // slon -- sorted longitude
 // lon -- unsorted longitude
-// dst -- resampled image (output)
+// gaponly -- only interpolate reordered and invalid pixels
+// dst -- resampled image channels (output)
 // ilon -- interpolated sorted longitude (output)
 // 
-static void
-resample2d(const Mat &sortidx, const Mat &ssrc, const Mat &slat, const Mat &slon,
-	const Mat &lon, Mat &dst, Mat &ilon)
+void
+resample2d(const Mat &sortidx, const vector<Mat> &ssrc, const Mat &slat, const Mat &slon,
+	const Mat &lon, bool gaponly, vector<Mat> &dst, Mat &ilon)
 {
-	CHECKMAT(ssrc, CV_32FC1);
+	Timer t(STAGE_RESAMPLE);
+	int nch = ssrc.size();
+	CV_Assert(nch > 0);
+	for(int c = 0; c < nch; c++){
+		CHECKMAT(ssrc[c], CV_32FC1);
+		CV_Assert(ssrc[c].size() == ssrc[0].size());
+	}
 	CHECKMAT(slat, CV_32FC1);
 	CHECKMAT(slon, CV_32FC1);
 	CHECKMAT(sortidx, CV_32SC1);
-	CV_Assert(ssrc.data != dst.data);
 
-	int width = ssrc.cols;
-	int height = ssrc.rows;
+	int width = ssrc[0].cols;
+	int height = ssrc[0].rows;
 	
 	// compute resolution per column based on the first two rows
 	Mat _res = Mat::zeros(1, width, CV_64FC1);
@@ -550,27 +675,42 @@ resample2d(const Mat &sortidx, const Mat &ssrc, const Mat &slat, const Mat &slon
 	//float *lon2 = (float*)slon.ptr(1);
 	for(int j = 0; j < width; j++){
 		//res[j] = geodist(lat1[j], lon1[j], lat2[j], lon2[j])/4.0;
-		double x = 2*j/(double)width - 1.0;
-		res[j] = 0.1*SQ(x) + 0.1;
+		res[j] = columnres(j, width);
 	}
-	if(DEBUG)dumpmat("res.bin", _res);
+	capture(CAP_RES, _res);
 
-	// allocate output and temporary bufferes for each column
-	dst = Mat::zeros(height, width, CV_32FC1);
-	ilon = Mat::zeros(height, width, CV_32FC1);
+	// allocate output and temporary bufferes for each column;
+	// the outputs are kept if they're the right size already,
+	// and every column of them is set below
+	dst.resize(nch);
+	for(int c = 0; c < nch; c++){
+		dst[c].create(height, width, CV_32FC1);
+	}
+	ilon.create(height, width, CV_32FC1);
 	Mat sindcol = Mat::zeros(height, 1, CV_32SC1);
-	Mat ssrccol = Mat::zeros(height, 1, CV_32FC1);
+	Mat ssrccol = Mat::zeros(nch, height, CV_32FC1);
 	Mat slatcol = Mat::zeros(height, 1, CV_32FC1);
 	Mat sloncol = Mat::zeros(height, 1, CV_32FC1);
 	Mat loncol = Mat::zeros(height, 1, CV_32FC1);
-	Mat dstcol = Mat::zeros(height, 1, CV_32FC1);
+	Mat dstcol = Mat::zeros(nch, height, CV_32FC1);
 	Mat iloncol = Mat::zeros(height, 1, CV_32FC1);
+
+	// row c of ssrccol and dstcol is the column buffer for channel c
+	vector<const float*> ssrcp(nch);
+	vector<float*> dstp(nch);
+	for(int c = 0; c < nch; c++){
+		ssrcp[c] = ssrccol.ptr<float>(c);
+		dstp[c] = dstcol.ptr<float>(c);
+	}
 	
 	// resample each column
 	for(int j = 0; j < width; j++){
-		// copy columns to contiguous Mats, so we don't have to worry about stride
+		// copy columns to contiguous buffers, so we don't have to worry about stride
 		sortidx.col(j).copyTo(sindcol.col(0));
-		ssrc.col(j).copyTo(ssrccol.col(0));
+		for(int c = 0; c < nch; c++){
+			Mat m(height, 1, CV_32FC1, ssrccol.ptr<float>(c));
+			ssrc[c].col(j).copyTo(m);
+		}
 		slat.col(j).copyTo(slatcol.col(0));
 		slon.col(j).copyTo(sloncol.col(0));
 		lon.col(j).copyTo(loncol.col(0));
@@ -584,57 +724,292 @@ resample2d(const Mat &sortidx, const Mat &ssrc, const Mat &slat, const Mat &slon
 		iloncol.col(0).copyTo(ilon.col(j));
 		
 		// resample and copy column to output
-		resample1d(sindcol.ptr<int>(0),
-			ssrccol.ptr<float>(0),
+		resample1d_isa[isa_current()](sindcol.ptr<int>(0),
+			&ssrcp[0],
+			nch,
 			slatcol.ptr<float>(0),
 			sloncol.ptr<float>(0),
 			iloncol.ptr<float>(0),
 			height,
 			res[j],
-			dstcol.ptr<float>(0));
-		dstcol.col(0).copyTo(dst.col(j));
+			gaponly,
+			&dstp[0]);
+		for(int c = 0; c < nch; c++){
+			Mat m(height, 1, CV_32FC1, dstp[c]);
+			m.copyTo(dst[c].col(j));
+		}
+	}
+}
+
+// Convert band value val to physical value, or NAN if val is a fill value.
+static inline float
+band2phys(ushort val, double scale, double offset)
+{
+	if(isushortfill(val))
+		return NAN;
+	return scale*val + offset;
+}
+
+static inline float
+band2phys(float val, double scale, double offset)
+{
+	if(isfloatfill(val))
+		return NAN;
+	return val;
+}
+
+// Convert resampled physical value v at (x, y) back to a band value.
+// Raw is the sorted band value before resampling. It is kept for fill values
+// outside the deletion zone and for pixels that could not be resampled.
+// The bow-tie deleted pixels filled in and the values clamped to
+// the range of the band type are counted in *nbowtie and *nclamped.
+static inline ushort
+phys2band(float v, ushort raw, double scale, double offset, int x, int y, int *nbowtie, int *nclamped)
+{
+	if((isushortfill(raw) && raw != DELETION_ZONE_INT) || isnan(v))
+		return raw;
+	if(raw == DELETION_ZONE_INT)
+		(*nbowtie)++;
+
+	int j = (int) round((v - offset)/scale);
+	if(j < 0){
+		printf("Output data out of range at ( %5i %5i ): %i\n", x, y, j);
+		j = 0;
+		(*nclamped)++;
 	}
+	if(j > 65535){
+		printf("Output data out of range at ( %5i %5i ): %i\n", x, y, j);
+		j = 65535;
+		(*nclamped)++;
+	}
+	return (ushort) j;
 }
 
+static inline float
+phys2band(float v, float raw, double scale, double offset, int x, int y, int *nbowtie, int *nclamped)
+{
+	if((isfloatfill(raw) && raw != DELETION_ZONE_FLOAT) || isnan(v))
+		return raw;
+	if(raw == DELETION_ZONE_FLOAT)
+		(*nbowtie)++;
+	return v;
+}
+
+template <class T>
+static void
+resample_band_fused_(const Mat &sind, Mat &img, const Mat &lat, const Mat &lon,
+	double scale, double offset, bool gaponly, Mat *simg, Mat *slat, Mat *ilon)
+{
+	int width = img.cols;
+	int height = img.rows;
+	
+	if(simg != NULL){
+		simg->create(height, width, img.type());
+	}
+	if(slat != NULL){
+		slat->create(height, width, CV_32FC1);
+		ilon->create(height, width, CV_32FC1);
+	}
+
+	// Column buffers for a block of COLBLOCK columns, stored column after column.
+	// Rows of a block are gathered together so each source row is read
+	// with one cache line instead of one line per column.
+	vector<int> sindbuf(COLBLOCK*height);
+	vector<T> rawbuf(COLBLOCK*height);
+	vector<float> svalbuf(COLBLOCK*height);
+	vector<float> slatbuf(COLBLOCK*height);
+	vector<float> slonbuf(COLBLOCK*height);
+	vector<float> lonbuf(COLBLOCK*height);
+	vector<float> ilonbuf(height);
+	vector<float> dstbuf(height);
+	vector<float> iloncols(ilon != NULL ? COLBLOCK*height : 0);
+	int nbowtie = 0, nclamped = 0;
+
+	for(int j0 = 0; j0 < width; j0 += COLBLOCK){
+		int nb = width-j0 < COLBLOCK ? width-j0 : (int)COLBLOCK;
+
+		// gather the sorted columns through the sorting indices
+		for(int i = 0; i < height; i++){
+			const int *sp = sind.ptr<int>(i);
+			const float *lp = lon.ptr<float>(i);
+			for(int b = 0; b < nb; b++){
+				int j = j0 + b;
+				int k = sp[j];
+				int o = b*height + i;
+				sindbuf[o] = k;
+				rawbuf[o] = img.at<T>(k, j);
+				svalbuf[o] = band2phys(rawbuf[o], scale, offset);
+				slatbuf[o] = lat.at<float>(k, j);
+				slonbuf[o] = lon.at<float>(k, j);
+				lonbuf[o] = lp[j];
+			}
+		}
+
+		for(int b = 0; b < nb; b++){
+			int j = j0 + b;
+			int o = b*height;
+			
+			interplon(&sindbuf[o], &slonbuf[o], &lonbuf[o], height, &ilonbuf[0]);
+			if(ilon != NULL){
+				memcpy(&iloncols[o], &ilonbuf[0], height*sizeof(float));
+			}
+			const float *sval = &svalbuf[o];
+			float *dst = &dstbuf[0];
+			resample1d_isa[isa_current()](&sindbuf[o], &sval, 1, &slatbuf[o], &slonbuf[o],
+				&ilonbuf[0], height, columnres(j, width), gaponly, &dst);
+			
+			// requantize straight into the output,
+			// leaving the pixels resample1d did not touch bit-exact
+			for(int i = 0; i < height; i++){
+				if(gaponly && sindbuf[o+i] == i && !isnan(svalbuf[o+i]))
+					img.at<T>(i, j) = rawbuf[o+i];
+				else
+					img.at<T>(i, j) = phys2band(dstbuf[i], rawbuf[o+i], scale, offset, j, i,
+						&nbowtie, &nclamped);
+			}
+		}
+
+		if(simg != NULL){
+			for(int i = 0; i < height; i++){
+				T *p = simg->ptr<T>(i);
+				for(int b = 0; b < nb; b++){
+					p[j0+b] = rawbuf[b*height + i];
+				}
+			}
+		}
+		if(slat != NULL){
+			for(int i = 0; i < height; i++){
+				float *lap = slat->ptr<float>(i);
+				float *lop = ilon->ptr<float>(i);
+				for(int b = 0; b < nb; b++){
+					lap[j0+b] = slatbuf[b*height + i];
+					lop[j0+b] = iloncols[b*height + i];
+				}
+			}
+		}
+	}
+	report_count(COUNT_BOWTIE, nbowtie);
+	report_count(COUNT_CLAMPED, nclamped);
+}
+
+// Resample a VIIRS band in a single pass, without full-size intermediate images.
+// Each block of columns is sorted, resampled and requantized back into
+// the band type before moving on to the next block.
+//
+// sind -- latitude sorting indices
+// img -- band image of type CV_16UC1 or CV_32FC1 (input & output)
+// lat -- unsorted latitude
+// lon -- unsorted longitude
+// scale, offset -- scaling from band value to physical value (ignored for CV_32FC1)
+// gaponly -- only interpolate reordered and fill pixels
+// simg -- sorted band image before resampling (output, optional)
+// slat, ilon -- sorted latitude and interpolated sorted longitude,
+//	the geolocation of the resampled image (output, optional, both or neither)
+//
 void
-resample_viirs_mat(Mat &img, Mat &lat, Mat &lon, bool sortoutput)
+resample_band_fused(const Mat &sind, Mat &img, const Mat &lat, const Mat &lon,
+	double scale, double offset, bool gaponly, Mat *simg, Mat *slat, Mat *ilon)
 {
-	Mat sind, dst, ilon;
+	Timer t(STAGE_FUSED);
+	CHECKMAT(sind, CV_32SC1);
+	CHECKMAT(lat, CV_32FC1);
+	CHECKMAT(lon, CV_32FC1);
+	CV_Assert(img.isContinuous());
+	CV_Assert(sind.size() == img.size() && lat.size() == img.size() && lon.size() == img.size());
+
+	switch(img.type()) {
+	default:
+		eprintf("resample_band_fused: unsupported type %s\n", type2str(img.type()));
+		break;
+	case CV_16UC1:
+		resample_band_fused_<ushort>(sind, img, lat, lon, scale, offset, gaponly, simg, slat, ilon);
+		break;
+	case CV_32FC1:
+		resample_band_fused_<float>(sind, img, lat, lon, scale, offset, gaponly, simg, slat, ilon);
+		break;
+	}
+}
+
+// Resample several images sharing the same geolocation.
+// Sorting, longitude interpolation and resampling weights
+// are computed only once for all the images.
+//
+// imgs -- images to be resampled (input & output)
+// lat -- corresponding latitude image (input & output)
+// lon -- corresponding longitude image (input & output)
+// sortoutput -- indicates if output should be in latitude sorted order
+// gaponly -- only interpolate reordered and invalid pixels;
+//	the others are only sorted
+//
+void
+resample_viirs_mat(vector<Mat> &imgs, Mat &lat, Mat &lon, bool sortoutput, bool gaponly)
+{
+	WsScope ws;
+	int nch = imgs.size();
 	
-	CHECKMAT(img, CV_32FC1);
+	CV_Assert(nch > 0);
+	for(int c = 0; c < nch; c++){
+		CHECKMAT(imgs[c], CV_32FC1);
+	}
 	CHECKMAT(lat, CV_32FC1);
 	CHECKMAT(lon, CV_32FC1);
 	
-	if(DEBUG)dumpmat("before.bin", img);
-	if(DEBUG)dumpmat("lat.bin", lat);
-	if(DEBUG)dumpmat("lon.bin", lon);
+	capture(CAP_BEFORE, imgs[0]);
+	capture(CAP_LAT, lat);
+	capture(CAP_LON, lon);
+
+	// the intermediates are workspace planes, copied
+	// into imgs, lat and lon at the end
+	int h = lat.rows, w = lat.cols;
+	Mat sind = wsmat(h, w, CV_32SC1);
+	Mat slat = wsmat(h, w, CV_32FC1);
+	Mat slon = wsmat(h, w, CV_32FC1);
+	Mat ilon = wsmat(h, w, CV_32FC1);
+	vector<Mat> simgs(nch), dsts(nch);
+	for(int c = 0; c < nch; c++){
+		simgs[c] = wsmat(h, w, CV_32FC1);
+		dsts[c] = wsmat(h, w, CV_32FC1);
+	}
 
 	getadjustedsortingind(sind, lat);
 
-	Mat slat = resample_sort(sind, lat);
-	Mat slon = resample_sort(sind, lon);
-	Mat simg = resample_sort(sind, img);
-	if(DEBUG)dumpmat("sind.bin", sind);
-	if(DEBUG)dumpmat("simg.bin", simg);
-	if(DEBUG)dumpmat("slat.bin", slat);
-	if(DEBUG)dumpmat("slon.bin", slon);
+	resample_sort(sind, lat, slat);
+	resample_sort(sind, lon, slon);
+	for(int c = 0; c < nch; c++){
+		resample_sort(sind, imgs[c], simgs[c]);
+	}
+	capture(CAP_SIND, sind);
+	capture(CAP_SIMG, simgs[0]);
+	capture(CAP_SLAT, slat);
+	capture(CAP_SLON, slon);
 	
-	resample2d(sind, simg, slat, slon, lon, dst, ilon);
-	CV_Assert(dst.size() == img.size() && dst.type() == img.type());
+	resample2d(sind, simgs, slat, slon, lon, gaponly, dsts, ilon);
 	CV_Assert(ilon.size() == lon.size() && ilon.type() == lon.type());
-	if(DEBUG)dumpmat("after.bin", dst);
-	if(DEBUG)dumpmat("ilon.bin", ilon);
+	capture(CAP_AFTER, dsts[0]);
+	capture(CAP_ILON, ilon);
 	
+	for(int c = 0; c < nch; c++){
+		CV_Assert(dsts[c].size() == imgs[c].size() && dsts[c].type() == imgs[c].type());
+		if(!sortoutput){
+			dsts[c] = resample_unsort(sind, dsts[c]);
+		}
+		dsts[c].copyTo(imgs[c]);
+	}
 	if(!sortoutput){
-		dst = resample_unsort(sind, dst);
 		ilon = resample_unsort(sind, ilon);
 	}
-	dst.copyTo(img);
 	ilon.copyTo(lon);
 	if(sortoutput){
 		slat.copyTo(lat);
 	}
-	if(DEBUG)dumpmat("final.bin", img);
+	capture(CAP_FINAL, imgs[0]);
+}
+
+void
+resample_viirs_mat(Mat &img, Mat &lat, Mat &lon, bool sortoutput, bool gaponly)
+{
+	vector<Mat> imgs(1, img);
+	resample_viirs_mat(imgs, lat, lon, sortoutput, gaponly);
 }
 
 // Resample a VIIRS swath image.
@@ -645,12 +1020,11 @@ resample_viirs_mat(Mat &img, Mat &lat, Mat &lon, bool sortoutput)
 // nx -- width of image (should be 3200 for VIIRS)
 // ny -- height of image (5408 or 5392 for ~10 min VIIRS granule)
 // sortoutput -- indicates if output should be in latitude sorted order
+// gaponly -- only interpolate reordered and invalid pixels
 //
 void
-resample_viirs(float **_img, float **_lat, float **_lon, int nx, int ny, bool sortoutput)
+resample_viirs(float **_img, float **_lat, float **_lon, int nx, int ny, bool sortoutput, bool gaponly)
 {
-	if(DEBUG) printf("resampling debugging is turned on!\n");
-
 	if(ny%NDETECTORS != 0){
 		eprintf("invalid height %d (not multiple of %d)\n", ny, NDETECTORS);
 	}
@@ -664,8 +1038,5 @@ resample_viirs(float **_img, float **_lat, float **_lon, int nx, int ny, bool so
 	Mat lat(ny, nx, CV_32FC1, &_lat[0][0]);
 	Mat lon(ny, nx, CV_32FC1, &_lon[0][0]);
 
-	resample_viirs_mat(img, lat, lon, sortoutput);
-
-	//if(DEBUG)dumpfloat("final.bin", &_img[0][0], nx*ny);
-	if(DEBUG)exit(3);
+	resample_viirs_mat(img, lat, lon, sortoutput, gaponly);
 }
@@ -0,0 +1,387 @@
+//
+// Resampling service on a Unix domain socket
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include "viirsresam.h"
+
+// Cached geolocation plan. The file's device, inode, size and
+// modification time must match for the plan to be reused.
+struct PlanEntry {
+	char	path[1024];
+	struct stat	st;
+	GeoPlan	*plan;
+	int	refs;	// requests using plan
+	unsigned long	used;	// time of last use, from Server.clock
+};
+
+struct Server {
+	const ResamOpts	*opts;
+	int	ncache;	// maximum number of cached plans
+	pthread_mutex_t	lock;	// protects the fields below
+	vector<PlanEntry*>	cache;
+	unsigned long	clock;
+	vector<int>	conns;	// connections being served
+	int	nreq, nhit;
+};
+
+// Connection handed to a worker.
+struct Conn {
+	Server	*srv;
+	int	fd;
+};
+
+static volatile sig_atomic_t stopping;
+
+static void
+onsignal(int sig)
+{
+	stopping = 1;
+}
+
+static double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+static bool
+samefile(const struct stat *a, const struct stat *b)
+{
+	return a->st_dev == b->st_dev && a->st_ino == b->st_ino
+		&& a->st_size == b->st_size
+		&& a->st_mtim.tv_sec == b->st_mtim.tv_sec
+		&& a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static void
+freeentry(PlanEntry *e)
+{
+	viirs_geoplan_free(e->plan);
+	delete e;
+}
+
+// Remove the least recently used plans not in use until
+// there are at most srv->ncache. Called with srv->lock held.
+//
+static void
+evict(Server *srv)
+{
+	while((int)srv->cache.size() > srv->ncache){
+		int k = -1;
+		for(int i = 0; i < (int)srv->cache.size(); i++){
+			PlanEntry *e = srv->cache[i];
+			if(e->refs == 0 && (k < 0 || e->used < srv->cache[k]->used))
+				k = i;
+		}
+		if(k < 0)
+			break;
+		freeentry(srv->cache[k]);
+		srv->cache.erase(srv->cache.begin() + k);
+	}
+}
+
+// Return the cached plan for geofile, creating it if it's not cached
+// or the file has changed since. The entry must be released with
+// putplan. Sets *hit if the plan was cached.
+//
+static PlanEntry*
+getplan(Server *srv, const char *geofile, Status *st, bool *hit)
+{
+	struct stat sb;
+	PlanEntry *e;
+
+	*hit = false;
+	if(stat(geofile, &sb) != 0){
+		st->code = STATUS_ERROR;
+		snprintf(st->msg, sizeof(st->msg), "stat %s failed: %s", geofile, strerror(errno));
+		return NULL;
+	}
+	pthread_mutex_lock(&srv->lock);
+	for(int i = 0; i < (int)srv->cache.size(); i++){
+		e = srv->cache[i];
+		if(strcmp(e->path, geofile) == 0 && samefile(&e->st, &sb)){
+			e->refs++;
+			e->used = ++srv->clock;
+			*hit = true;
+			pthread_mutex_unlock(&srv->lock);
+			return e;
+		}
+	}
+	pthread_mutex_unlock(&srv->lock);
+
+	// Read without the lock. Another request may be reading the same
+	// file, in which case both plans are cached until one is evicted.
+	e = new PlanEntry;
+	*st = viirs_geoplan_create(geofile, &e->plan);
+	if(st->code != STATUS_OK){
+		delete e;
+		return NULL;
+	}
+	snprintf(e->path, sizeof(e->path), "%s", geofile);
+	e->st = sb;
+	e->refs = 1;
+
+	pthread_mutex_lock(&srv->lock);
+	e->used = ++srv->clock;
+	srv->cache.push_back(e);
+	evict(srv);
+	pthread_mutex_unlock(&srv->lock);
+	return e;
+}
+
+static void
+putplan(Server *srv, PlanEntry *e)
+{
+	pthread_mutex_lock(&srv->lock);
+	e->refs--;
+	evict(srv);
+	pthread_mutex_unlock(&srv->lock);
+}
+
+// Run the request in line, which is "geofile file" or a single ACSPO
+// or L2P GHRSST file, like a manifest line of --batch.
+//
+static Status
+request(Server *srv, char *line, bool *hit)
+{
+	Status st = {STATUS_OK, ""};
+	char *f[3], *s, *tok;
+	int n;
+
+	*hit = false;
+	n = 0;
+	for(tok = strtok_r(line, " \t\r\n", &s); tok != NULL; tok = strtok_r(NULL, " \t\r\n", &s)){
+		if(n == 2){
+			n++;
+			break;
+		}
+		f[n++] = tok;
+	}
+	if(n < 1 || n > 2){
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "bad request: want \"geofile file\" or \"file\"");
+		return st;
+	}
+	if(n == 1){
+		return viirs_resample_file(NULL, f[0], srv->opts);
+	}
+	// files already resampled are skipped without loading the geolocation
+	int type = getfiletype(f[1]);
+	bool done = false;
+	if(!srv->opts->force){
+		st = viirs_resampled(f[1], &done);
+		if(st.code != STATUS_OK){
+			return st;
+		}
+	}
+	if(type == GMTCO || type == ACSPO || type == L2P_GHRSST || srv->opts->region != NULL || done){
+		return viirs_resample_file(f[0], f[1], srv->opts);
+	}
+	PlanEntry *e = getplan(srv, f[0], &st, hit);
+	if(e == NULL){
+		return st;
+	}
+	st = viirs_resample_band_plan(e->plan, f[1], srv->opts);
+	putplan(srv, e);
+	return st;
+}
+
+static void
+reply(int fd, const char *s)
+{
+	size_t n = strlen(s);
+
+	while(n > 0){
+		ssize_t w = send(fd, s, n, MSG_NOSIGNAL);
+		if(w <= 0){
+			if(w < 0 && errno == EINTR)
+				continue;
+			return;	// client went away; the reads will notice
+		}
+		s += w;
+		n -= w;
+	}
+}
+
+// Serve the requests of a connection, one per line, until the
+// client closes it. Each request gets a reply line
+// "ok seconds cached|read|skipped" or "FAIL seconds message".
+//
+static void
+serveconn(void *arg)
+{
+	Conn *c = (Conn*)arg;
+	Server *srv = c->srv;
+	char *line = NULL;
+	size_t linecap = 0;
+	char buf[512];
+	bool hit;
+
+	FILE *f = fdopen(c->fd, "r");
+	if(f == NULL){
+		close(c->fd);
+	}
+	while(f != NULL && getline(&line, &linecap, f) != -1){
+		double t0 = now();
+		Status st = request(srv, line, &hit);
+		double secs = now() - t0;
+
+		if(st.code == STATUS_OK){
+			snprintf(buf, sizeof(buf), "ok %.3f %s\n", secs,
+				st.skipped ? "skipped" : hit ? "cached" : "read");
+		}else{
+			for(char *p = st.msg; *p != '\0'; p++){
+				if(*p == '\n')
+					*p = ' ';
+			}
+			snprintf(buf, sizeof(buf), "FAIL %.3f %s\n", secs, st.msg);
+		}
+		reply(c->fd, buf);
+
+		pthread_mutex_lock(&srv->lock);
+		srv->nreq++;
+		if(hit)
+			srv->nhit++;
+		pthread_mutex_unlock(&srv->lock);
+	}
+	free(line);
+
+	pthread_mutex_lock(&srv->lock);
+	for(int i = 0; i < (int)srv->conns.size(); i++){
+		if(srv->conns[i] == c->fd){
+			srv->conns.erase(srv->conns.begin() + i);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&srv->lock);
+	if(f != NULL)
+		fclose(f);
+	delete c;
+}
+
+// Listen on Unix domain socket sockpath and serve resampling requests
+// with nthreads worker threads, one connection per worker at a time.
+// A request is a line "GMODOfile file" or "ACSPO/GHRSSTfile", answered
+// by a line "ok seconds cached|read|skipped" or "FAIL seconds message".
+// The geolocation plans of the last ncache GMODO files are kept, so
+// repeated requests for the same granule don't read and sort the
+// geolocation again. Runs until SIGINT or SIGTERM, and then finishes
+// the requests being run.
+//
+Status
+viirs_run_server(const char *sockpath, int nthreads, int ncache, const ResamOpts *opts)
+{
+	Status st = {STATUS_OK, ""};
+	struct sockaddr_un addr;
+	struct sigaction sa, oldint, oldterm;
+	sigset_t sigs, oldsigs;
+	struct stat sb;
+	Server srv;
+	Pool *pool;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(sockpath) >= sizeof(addr.sun_path)){
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "socket path too long: %s", sockpath);
+		return st;
+	}
+	strcpy(addr.sun_path, sockpath);
+
+	// remove the socket left by a previous run
+	if(lstat(sockpath, &sb) == 0 && S_ISSOCK(sb.st_mode)){
+		unlink(sockpath);
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if(fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0){
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "listen on %s failed: %s", sockpath, strerror(errno));
+		if(fd >= 0)
+			close(fd);
+		return st;
+	}
+
+	srv.opts = opts;
+	srv.ncache = ncache;
+	srv.clock = 0;
+	srv.nreq = srv.nhit = 0;
+
+	// As in viirs_run_spool, the signals only interrupt this thread.
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+	try{
+		pool = pool_create(nthreads);
+	}catch(const std::exception &e){
+		pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+		close(fd);
+		unlink(sockpath);
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "%s", e.what());
+		return st;
+	}
+	stopping = 0;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = onsignal;	// no SA_RESTART, so accept is interrupted
+	sigaction(SIGINT, &sa, &oldint);
+	sigaction(SIGTERM, &sa, &oldterm);
+	pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+	pthread_mutex_init(&srv.lock, NULL);
+
+	printf("server: listening on %s\n", sockpath);
+	fflush(stdout);
+	while(!stopping){
+		int cfd = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+		if(cfd < 0){
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+			st.code = STATUS_ERROR;
+			snprintf(st.msg, sizeof(st.msg), "accept failed: %s", strerror(errno));
+			break;
+		}
+		Conn *c = new Conn;
+		c->srv = &srv;
+		c->fd = cfd;
+		pthread_mutex_lock(&srv.lock);
+		srv.conns.push_back(cfd);
+		pthread_mutex_unlock(&srv.lock);
+		pool_submit(pool, serveconn, c);
+	}
+	close(fd);
+	unlink(sockpath);
+	sigaction(SIGINT, &oldint, NULL);
+	sigaction(SIGTERM, &oldterm, NULL);
+
+	// Stop reading new requests; the running ones finish and
+	// get their reply.
+	printf("server: waiting for running requests\n");
+	fflush(stdout);
+	pthread_mutex_lock(&srv.lock);
+	for(int i = 0; i < (int)srv.conns.size(); i++){
+		shutdown(srv.conns[i], SHUT_RD);
+	}
+	pthread_mutex_unlock(&srv.lock);
+	pool_destroy(pool);
+
+	pthread_mutex_destroy(&srv.lock);
+	for(int i = 0; i < (int)srv.cache.size(); i++){
+		freeentry(srv.cache[i]);
+	}
+	printf("server: %d requests, %d with cached geolocation\n", srv.nreq, srv.nhit);
+	return st;
+}
@@ -0,0 +1,403 @@
+//
+// Spool directory daemon resampling granules as their files arrive
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <pthread.h>
+#include "viirsresam.h"
+
+enum {
+	MAXPATH = 1024,
+	MAXKEY = 128,
+	TCBAND = 0,	// index of the GMTCO file in SpoolSet.files
+};
+
+struct Spool;
+
+// Files of a granule found in the spool directory.
+// Files are named like SVM15_npp_d20151216_t0100000_e0101000_b00001_c..._noaa_ops.h5,
+// and the files of a granule share the platform, date, start, end and orbit
+// fields, which make up the key.
+struct SpoolSet {
+	char	key[MAXKEY];
+	char	geofile[MAXPATH];	// GMODO file, or empty
+	char	files[NBANDS+1][MAXPATH];	// GMTCO file and band files by band number, or empty
+	Spool	*spool;
+};
+
+struct Spool {
+	const char	*indir;
+	const char	*outdir;
+	bool	want[NBANDS+1];	// files needed for a complete set: GMTCO and bands by number
+	const ResamOpts	*opts;
+	vector<SpoolSet*>	sets;	// incomplete sets, only used by the main thread
+	vector<SpoolSet*>	running;	// sets dispatched to the pool
+	pthread_mutex_t	lock;	// protects running, nfailed and ndone
+	int	ndone, nfailed;
+};
+
+static volatile sig_atomic_t stopping;
+
+static void
+onsignal(int sig)
+{
+	stopping = 1;
+}
+
+// Parse the file name into the key of its granule.
+// Returns the band number, TCBAND for GMTCO, -1 for GMODO, or -2
+// if the file is not part of a granule.
+//
+static int
+spoolname(const char *name, char *key)
+{
+	int band;
+	const char *p;
+
+	if(strncmp(name, "GMODO_", 6) == 0){
+		band = -1;
+	}else if(strncmp(name, "GMTCO_", 6) == 0){
+		band = TCBAND;
+	}else if(strncmp(name, "SVM", 3) == 0 && isdigit(name[3]) && isdigit(name[4]) && name[5] == '_'){
+		band = (name[3]-'0')*10 + (name[4]-'0');
+		if(band < 1 || band > NBANDS)
+			return -2;
+	}else{
+		return -2;
+	}
+	if(strcmp(name + strlen(name) - 3, ".h5") != 0){
+		return -2;
+	}
+
+	// key is the 5 fields after the product name
+	p = name + 6;
+	for(int i = 0; i < 5; i++){
+		p = strchr(p, '_');
+		if(p == NULL){
+			return -2;
+		}
+		p++;
+	}
+	int n = (p - 1) - (name + 6);
+	if(n >= MAXKEY){
+		return -2;
+	}
+	memcpy(key, name + 6, n);
+	key[n] = '\0';
+	return band;
+}
+
+static bool
+setcomplete(const SpoolSet *s)
+{
+	if(s->geofile[0] == '\0'){
+		return false;
+	}
+	for(int i = 0; i <= NBANDS; i++){
+		if(s->spool->want[i] && s->files[i][0] == '\0'){
+			return false;
+		}
+	}
+	return true;
+}
+
+// Move file into directory dir. Returns false on error.
+static bool
+movefile(const char *file, const char *dir)
+{
+	char path[2*MAXPATH];
+	const char *p = strrchr(file, '/');
+
+	snprintf(path, sizeof(path), "%s/%s", dir, p != NULL ? p+1 : file);
+	if(rename(file, path) != 0){
+		fprintf(stderr, "spool: rename %s %s: %s\n", file, path, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+// Move the file written next to file, named file with suffix
+// ext, into directory dir if there is one.
+static void
+movesidecar(const char *file, const char *ext, const char *dir)
+{
+	char path[MAXPATH+16];
+
+	snprintf(path, sizeof(path), "%s%s", file, ext);
+	if(access(path, F_OK) == 0){
+		movefile(path, dir);
+	}
+}
+
+static double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+// Resample a complete set of files with a worker thread.
+// The geolocation is read once for all the bands.
+// Afterwards the files are moved to outdir, or to outdir/failed
+// if anything failed.
+//
+static void
+runset(void *arg)
+{
+	SpoolSet *s = (SpoolSet*)arg;
+	Spool *sp = s->spool;
+	char faildir[MAXPATH+16];
+	GeoPlan *plan;
+	Status st;
+	int nfailed = 0;
+
+	double t0 = now();
+
+	// the geolocation isn't read if the bands were all already resampled
+	bool needplan = false;
+	for(int i = 0; i <= NBANDS && !needplan; i++){
+		bool done;
+		if(i == TCBAND || s->files[i][0] == '\0'){
+			continue;
+		}
+		needplan = sp->opts->force || viirs_resampled(s->files[i], &done).code != STATUS_OK || !done;
+	}
+	plan = NULL;
+	if(needplan){
+		st = viirs_geoplan_create(s->geofile, &plan);
+		if(st.code != STATUS_OK){
+			fprintf(stderr, "spool: %s: %s\n", s->geofile, st.msg);
+			nfailed++;
+		}
+	}
+	for(int i = 0; i <= NBANDS && (plan != NULL || !needplan); i++){
+		if(s->files[i][0] == '\0'){
+			continue;
+		}
+		if(i == TCBAND){
+			st = viirs_resample_tcgeo(s->geofile, s->files[i], sp->opts);
+		}else if(plan != NULL){
+			st = viirs_resample_band_plan(plan, s->files[i], sp->opts);
+		}else{
+			st = viirs_resample_band(s->geofile, s->files[i], sp->opts);
+		}
+		if(st.code != STATUS_OK){
+			fprintf(stderr, "spool: %s: %s\n", s->files[i], st.msg);
+			nfailed++;
+		}
+	}
+	viirs_geoplan_free(plan);
+
+	const char *dir = sp->outdir;
+	if(nfailed > 0){
+		snprintf(faildir, sizeof(faildir), "%s/failed", sp->outdir);
+		mkdir(faildir, 0777);
+		dir = faildir;
+	}
+	movefile(s->geofile, dir);
+	for(int i = 0; i <= NBANDS; i++){
+		if(s->files[i][0] != '\0'){
+			movefile(s->files[i], dir);
+		}
+	}
+	for(int i = 0; i <= NBANDS; i++){
+		if(s->files[i][0] == '\0'){
+			continue;
+		}
+		if(i == TCBAND && sp->opts->index){
+			movesidecar(s->files[i], ".idx", dir);
+		}
+		if(i != TCBAND && sp->opts->gridres > 0){
+			movesidecar(s->files[i], ".grid", dir);
+		}
+	}
+	printf("spool: %s %s in %.3f seconds\n", s->key, nfailed > 0 ? "FAILED" : "done", now() - t0);
+	fflush(stdout);
+	metrics_granule();
+
+	pthread_mutex_lock(&sp->lock);
+	sp->ndone++;
+	if(nfailed > 0)
+		sp->nfailed++;
+	for(int i = 0; i < (int)sp->running.size(); i++){
+		if(sp->running[i] == s){
+			sp->running.erase(sp->running.begin() + i);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sp->lock);
+	delete s;
+}
+
+// Whether the granule of key is being resampled. Its files are
+// rewritten in indir, and their events must not start a new set.
+static bool
+isrunning(Spool *sp, const char *key)
+{
+	bool running = false;
+
+	pthread_mutex_lock(&sp->lock);
+	for(int i = 0; i < (int)sp->running.size() && !running; i++){
+		running = strcmp(sp->running[i]->key, key) == 0;
+	}
+	pthread_mutex_unlock(&sp->lock);
+	return running;
+}
+
+// Add file name in the spool directory to its set, and
+// dispatch the set to the pool once it's complete. The events
+// for the files of a set being resampled, written in place, are
+// ignored, as are those of files already moved to outdir.
+//
+static void
+addfile(Spool *sp, Pool *pool, const char *name)
+{
+	char key[MAXKEY], path[MAXPATH];
+	SpoolSet *s;
+	int i, band;
+
+	band = spoolname(name, key);
+	if(band < -1 || (band >= 0 && !sp->want[band])){
+		return;
+	}
+	snprintf(path, sizeof(path), "%s/%s", sp->indir, name);
+	if(isrunning(sp, key) || access(path, F_OK) != 0){
+		return;
+	}
+	for(i = 0; i < (int)sp->sets.size(); i++){
+		if(strcmp(sp->sets[i]->key, key) == 0)
+			break;
+	}
+	if(i == (int)sp->sets.size()){
+		s = new SpoolSet;
+		memset(s, 0, sizeof(*s));
+		snprintf(s->key, sizeof(s->key), "%s", key);
+		s->spool = sp;
+		sp->sets.push_back(s);
+	}
+	s = sp->sets[i];
+	if(band == -1){
+		snprintf(s->geofile, sizeof(s->geofile), "%s", path);
+	}else{
+		snprintf(s->files[band], sizeof(s->files[band]), "%s", path);
+	}
+	if(setcomplete(s)){
+		sp->sets.erase(sp->sets.begin() + i);
+		pthread_mutex_lock(&sp->lock);
+		sp->running.push_back(s);
+		pthread_mutex_unlock(&sp->lock);
+		pool_submit(pool, runset, s);
+	}
+}
+
+// Watch directory indir for VIIRS files and resample each granule with
+// nthreads worker threads once its GMODO file and the files selected by
+// want have arrived. Want[0] selects the GMTCO file and want[b] band Mb.
+// Resampled files are moved to outdir, or outdir/failed on error.
+// Files already in indir are picked up at startup. Runs until SIGINT
+// or SIGTERM, and then waits for the running granules to finish.
+//
+Status
+viirs_run_spool(const char *indir, const char *outdir, const bool *want, int nthreads,
+	const ResamOpts *opts)
+{
+	Status st = {STATUS_OK, ""};
+	char buf[64*1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct sigaction sa, oldint, oldterm;
+	sigset_t sigs, oldsigs;
+	Spool sp;
+	Pool *pool;
+	int fd;
+
+	sp.indir = indir;
+	sp.outdir = outdir;
+	memcpy(sp.want, want, sizeof(sp.want));
+	sp.opts = opts;
+	sp.ndone = sp.nfailed = 0;
+
+	fd = inotify_init1(IN_CLOEXEC);
+	if(fd < 0 || inotify_add_watch(fd, indir, IN_CLOSE_WRITE|IN_MOVED_TO) < 0){
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "cannot watch %s: %s", indir, strerror(errno));
+		if(fd >= 0)
+			close(fd);
+		return st;
+	}
+
+	// Workers are started with the signals blocked, so that they are
+	// delivered to this thread and interrupt the read below.
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+	try{
+		pool = pool_create(nthreads);
+	}catch(const std::exception &e){
+		pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+		close(fd);
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "%s", e.what());
+		return st;
+	}
+	stopping = 0;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = onsignal;	// no SA_RESTART, so read is interrupted
+	sigaction(SIGINT, &sa, &oldint);
+	sigaction(SIGTERM, &sa, &oldterm);
+	pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+	pthread_mutex_init(&sp.lock, NULL);
+
+	// files that arrived before we started watching
+	DIR *d = opendir(indir);
+	if(d != NULL){
+		struct dirent *de;
+		while((de = readdir(d)) != NULL){
+			addfile(&sp, pool, de->d_name);
+		}
+		closedir(d);
+	}
+
+	printf("spool: watching %s\n", indir);
+	fflush(stdout);
+	while(!stopping){
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if(n < 0){
+			if(errno == EINTR)
+				continue;
+			st.code = STATUS_ERROR;
+			snprintf(st.msg, sizeof(st.msg), "read inotify events: %s", strerror(errno));
+			break;
+		}
+		for(char *p = buf; p < buf + n; ){
+			struct inotify_event *ev = (struct inotify_event*)p;
+			if(ev->len > 0 && !(ev->mask & IN_ISDIR)){
+				addfile(&sp, pool, ev->name);
+			}
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	close(fd);
+	sigaction(SIGINT, &oldint, NULL);
+	sigaction(SIGTERM, &oldterm, NULL);
+
+	printf("spool: waiting for running granules\n");
+	fflush(stdout);
+	pool_destroy(pool);
+	pthread_mutex_destroy(&sp.lock);
+	for(int i = 0; i < (int)sp.sets.size(); i++){
+		delete sp.sets[i];
+	}
+	printf("spool: %d granules resampled, %d failed\n", sp.ndone, sp.nfailed);
+	return st;
+}
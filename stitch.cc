@@ -0,0 +1,214 @@
+//
+// Resampling of consecutive granules as one continuous swath
+//
+
+#include <stdio.h>
+#include <string.h>
+#include "viirsresam.h"
+
+// A granule resampled on its own has no neighbors for its first and
+// last scans: they are sorted with the SORT_FIRST and SORT_LAST tables,
+// and its first and last rows are not resampled at all. In a swath of
+// consecutive granules, each granule is instead resampled with the
+// SEAMROWS rows (two scans) of the granules before and after it. As
+// for a region of a granule, the inner scan is needed by the resampling
+// stencil, and the outer one makes the inner one sorted the same way as
+// in the whole swath, so the granule comes out the same as if the swath
+// were a single granule. Only the granule's own rows are written back.
+//
+// The rows of the neighboring band and GMTCO files must be those from
+// before they were resampled. The granules are read in swath order:
+// the last rows of a file are carried over to the file of the next
+// granule, and the first rows of that file are read before it's
+// resampled.
+
+// Whether the rows of lat1 and lon1 follow those of lat0 and lon0
+// in the swath: at the middle of the scan, the first row of lat1 is
+// less than a scan away from the last row of lat0.
+static bool
+contiguous(const Mat &lat0, const Mat &lon0, const Mat &lat1, const Mat &lon1)
+{
+	if(lat0.cols != lat1.cols || lat1.rows <= NDETECTORS){
+		return false;
+	}
+	int x = lat1.cols/2;
+	int y = lat0.rows-1;
+	float la0 = lat0.at<float>(y, x), lo0 = lon0.at<float>(y, x);
+	float la1 = lat1.at<float>(0, x), lo1 = lon1.at<float>(0, x);
+	float la2 = lat1.at<float>(NDETECTORS, x), lo2 = lon1.at<float>(NDETECTORS, x);
+	if(!validgeo(la0, lo0) || !validgeo(la1, lo1) || !validgeo(la2, lo2)){
+		return false;
+	}
+	return geodist(la0, lo0, la1, lo1) < geodist(la1, lo1, la2, lo2);
+}
+
+// Read rows [row0, row0+nrows) of the datasets of file into rows,
+// and the scaling of a band other than M13 into *scale and *offset.
+// All rows are read if nrows is 0.
+static void
+readrows(const char *file, int row0, int nrows, vector<Mat> &rows, float *scale, float *offset)
+{
+	char names[2][128];
+	uvlong dims[32];
+
+	int n = viirs_datasets(file, names);
+	int type = getfiletype(file);
+	bool band16 = type != GMODO && type != GMTCO && getbandname(file) != 13;
+	*scale = 1;
+	*offset = 0;
+	rows.clear();
+	for(int i = 0; i < n; i++){
+		if(band16){
+			Cbuf<ushort> buf;
+			if(readwrite_viirs_rows(&buf.p, dims, scale, offset, file, names[i], 0, row0, nrows) != 0){
+				eprintf("Cannot read %s of %s", names[i], file);
+			}
+			int ny = nrows > 0 ? nrows : (int)dims[0];
+			rows.push_back(Mat(ny, dims[1], CV_16UC1, buf.p).clone());
+		}else{
+			Cbuf<float> buf;
+			if(readwrite_viirs_float_rows(&buf.p, dims, file, names[i], 0, row0, nrows) != 0){
+				eprintf("Cannot read %s of %s", names[i], file);
+			}
+			int ny = nrows > 0 ? nrows : (int)dims[0];
+			rows.push_back(Mat(ny, dims[1], CV_32FC1, buf.p).clone());
+		}
+	}
+}
+
+// Read the first SEAMROWS rows of file into rows, or the last ones
+// if last is set. Rows is left empty if file is too small.
+static void
+readseam(const char *file, bool last, vector<Mat> &rows, float *scale, float *offset)
+{
+	char names[2][128];
+	uvlong dims[32];
+
+	rows.clear();
+	if(viirs_datasets(file, names) == 0){
+		return;
+	}
+	if(viirs_dimsizes(file, names[0], dims) != 0){
+		eprintf("Cannot read dimensions of %s of %s", names[0], file);
+	}
+	if((int)dims[0] < SEAMROWS){
+		return;
+	}
+	readrows(file, last ? dims[0]-SEAMROWS : 0, SEAMROWS, rows, scale, offset);
+}
+
+static void
+readswathplan(const char *prevgeo, const char *geofile, const char *nextgeo, GeoPlan *plan)
+{
+	vector<Mat> geo, prev, next;
+	float scale, offset;
+
+	readrows(geofile, 0, 0, geo, &scale, &offset);
+	if(geo.size() != 2){
+		eprintf("%s is not a GMODO file", geofile);
+	}
+	if(prevgeo != NULL){
+		readseam(prevgeo, true, prev, &scale, &offset);
+		if(prev.size() == 2 && !contiguous(prev[0], prev[1], geo[0], geo[1])){
+			printf("%s does not follow %s; not stitched\n", geofile, prevgeo);
+			prev.clear();
+		}
+	}
+	if(nextgeo != NULL){
+		readseam(nextgeo, false, next, &scale, &offset);
+		if(next.size() == 2 && !contiguous(geo[0], geo[1], next[0], next[1])){
+			printf("%s does not follow %s; not stitched\n", nextgeo, geofile);
+			next.clear();
+		}
+	}
+	for(int i = 0; i < 2; i++){
+		vector<Mat> rows;
+		if(prev.size() == 2){
+			rows.push_back(prev[i]);
+		}
+		rows.push_back(geo[i]);
+		if(next.size() == 2){
+			rows.push_back(next[i]);
+		}
+		vconcat(rows, i == 0 ? plan->lat : plan->lon);
+	}
+	plan->top = prev.size() == 2 ? SEAMROWS : 0;
+	plan->bottom = next.size() == 2 ? SEAMROWS : 0;
+	getadjustedsortingind(plan->sind, plan->lat);
+	snprintf(plan->geofile, sizeof(plan->geofile), "%s", geofile);
+}
+
+// Read geolocation file geofile (GMODO) into a new plan like
+// viirs_geoplan_create, for a granule of a swath between the granules
+// of geolocation files prevgeo and nextgeo, which may be NULL. The plan
+// also has the SEAMROWS rows of each neighbor next to the granule,
+// unless it doesn't follow on from the granule.
+// On error, *plan is set to NULL.
+Status
+viirs_geoplan_swath(const char *prevgeo, const char *geofile, const char *nextgeo, GeoPlan **plan)
+{
+	Status st = {STATUS_OK, ""};
+
+	*plan = new GeoPlan;
+	try{
+		readswathplan(prevgeo, geofile, nextgeo, *plan);
+	}catch(const std::exception &e){
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "%s", e.what());
+		delete *plan;
+		*plan = NULL;
+	}
+	return st;
+}
+
+// Whether file will be left as it is because it was already resampled.
+static bool
+resampled(const char *file, const ResamOpts *opts)
+{
+	bool done;
+
+	if(opts->force){
+		return false;
+	}
+	Status st = viirs_resampled(file, &done);
+	if(st.code != STATUS_OK){
+		eprintf("%s", st.msg);
+	}
+	return done;
+}
+
+// Set seam to the rows that band or GMTCO file shares with the files
+// of the granules before and after it in a swath, for
+// viirs_band_read_swath or viirs_resample_tcgeo_swath. The top rows
+// are those carried in *carry from the file before it, and the bottom
+// rows are read from nextfile, which may be NULL. The last rows of
+// file are then carried in *carry to the next file. The files must be
+// given in swath order, each before it's written back. A file that
+// was already resampled has no rows to share, unless opts->force is set.
+Status
+viirs_seam_read(const char *file, const char *nextfile, Seam *carry, Seam *seam, const ResamOpts *opts)
+{
+	Status st = {STATUS_OK, ""};
+
+	seam->top.swap(carry->top);
+	seam->scale[0] = carry->scale[0];
+	seam->offset[0] = carry->offset[0];
+	seam->bottom.clear();
+	carry->top.clear();
+	try{
+		if(resampled(file, opts)){
+			return st;
+		}
+		readseam(file, true, carry->top, &carry->scale[0], &carry->offset[0]);
+		if(nextfile != NULL && !resampled(nextfile, opts)){
+			readseam(nextfile, false, seam->bottom, &seam->scale[1], &seam->offset[1]);
+		}
+	}catch(const std::exception &e){
+		seam->top.clear();
+		seam->bottom.clear();
+		carry->top.clear();
+		st.code = STATUS_ERROR;
+		snprintf(st.msg, sizeof(st.msg), "%s", e.what());
+	}
+	return st;
+}
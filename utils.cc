@@ -1,57 +1,20 @@
 #include "viirsresam.h"
 
+// Throw an Error with the formatted message. If fmt ends with ':',
+// the message for errno is appended.
 void
 eprintf(const char *fmt, ...)
 {
 	va_list args;
+	Error e;
+	int n;
 
-	fflush(stdout);
 	va_start(args, fmt);
-	vfprintf(stderr, fmt, args);
+	n = vsnprintf(e.msg, sizeof(e.msg), fmt, args);
 	va_end(args);
 
-	if(fmt[0] != '\0' && fmt[strlen(fmt)-1] == ':')
-		fprintf(stderr, " %s", strerror(errno));
-	fprintf(stderr, "\n");
-
-	exit(2);
+	if(fmt[0] != '\0' && fmt[strlen(fmt)-1] == ':' && n >= 0 && n < (int)sizeof(e.msg))
+		snprintf(e.msg+n, sizeof(e.msg)-n, " %s", strerror(errno));
+	throw e;
 }
 
-void
-dumpmat(const char *filename, Mat &m)
-{
-	int n;
-	FILE *f;
-
-	if(!m.isContinuous()) {
-		eprintf("m not continuous");
-	}
-	f = fopen(filename, "w");
-	if(!f) {
-		eprintf("open %s failed:", filename);
-	}
-	n = fwrite(m.data, m.elemSize1(), m.rows*m.cols, f);
-	if(n != m.rows*m.cols) {
-		fclose(f);
-		eprintf("wrote %d/%d items; write failed:", n, m.rows*m.cols);
-	}
-	fclose(f);
-}
-
-void
-dumpfloat(const char *filename, float *buf, int nbuf)
-{
-	int n;
-	FILE *f;
-
-	f = fopen(filename, "w");
-	if(!f) {
-		eprintf("open %s failed:", filename);
-	}
-	n = fwrite(buf, sizeof(*buf), nbuf, f);
-	if(n != nbuf) {
-		fclose(f);
-		eprintf("wrote %d/%d items; write failed:", n, nbuf);
-	}
-	fclose(f);
-}
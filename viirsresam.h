@@ -1,7 +1,9 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include <errno.h>
 #include <math.h>
+#include <exception>
 #include <opencv2/opencv.hpp>
 #include <netcdf.h>
 
@@ -39,22 +41,490 @@ const float VDNE_FLOAT32_FILL = -999.3;
 const ushort DELETION_ZONE_INT = ONBOARD_PT_UINT16_FILL;
 const float DELETION_ZONE_FLOAT = ONBOARD_PT_FLOAT32_FILL;
 
+inline bool
+isushortfill(ushort x)
+{
+	switch(x){
+	case NA_UINT16_FILL:
+	case MISS_UINT16_FILL:
+	case ONBOARD_PT_UINT16_FILL:
+	case ONGROUND_PT_UINT16_FILL:
+	case ERR_UINT16_FILL:
+	case VDNE_UINT16_FILL:
+	case SOUB_UINT16_FILL:
+		return true;
+	}
+	return false;
+}
+
+inline bool
+isfloatfill(float x)
+{
+	if(x == NA_FLOAT32_FILL
+	|| x == MISS_FLOAT32_FILL
+	|| x == ONBOARD_PT_FLOAT32_FILL
+	|| x == ONGROUND_PT_FLOAT32_FILL
+	|| x == ERR_FLOAT32_FILL
+	|| x == VDNE_FLOAT32_FILL){
+		return true;
+	}
+	return false;
+}
+
 enum {
 	VIIRS_WIDTH = 3200,
 	NDETECTORS = 16,
+	NBANDS = 16,	// moderate resolution bands M1 to M16
 	INVALID_TEMP = -999,
-	DEBUG = false,
+	COLBLOCK = 16,	// columns resampled together by resample_band_fused
+	SEAMROWS = 2*NDETECTORS,	// rows of each neighboring granule resampled with a granule of a swath
+	INDEXCOLS = 64,	// columns of a cell of a GeoIndex
+};
+
+// Error thrown by eprintf and ncfatal.
+// The library API returns it as a Status.
+class Error : public std::exception {
+public:
+	char	msg[256];
+
+	const char *what() const throw() { return msg; }
+};
+
+// File types returned by getfiletype.
+enum {
+	UNKNOWN,
+	ACSPO,
+	L2P_GHRSST,
+	GMODO,
+	GMTCO,
+};
+
+// Status returned by the library API.
+enum {
+	STATUS_OK = 0,
+	STATUS_ERROR = 2,	// same as the exit status of viirsresam on error
+};
+
+struct Status {
+	int	code;	// STATUS_OK or STATUS_ERROR
+	char	msg[256];	// error message if code is not STATUS_OK
+	bool	skipped;	// file left as it is because it was already resampled
+};
+
+// Part of a granule to resample, given either as
+// a range of rows or a latitude/longitude bounding box.
+struct Region {
+	int	row0, row1;	// rows [row0, row1)
+	bool	bbox;	// use bounding box instead of rows
+	float	latmin, latmax;
+	float	lonmin, lonmax;	// lonmin > lonmax if box crosses the antimeridian
+};
+
+// Resampling options, initialized by resamopts_init.
+struct ResamOpts {
+	bool	sortoutput;	// output in latitude sorted order
+	bool	extra;	// save the reordered band data in the band file
+	bool	fused;	// resample band in a single pass
+	bool	gaponly;	// only interpolate deleted, fill and reordered pixels
+	bool	force;	// resample files that were already resampled again
+	bool	stitch;	// resample the granules of a batch as one swath (see stitch.cc)
+	bool	index;	// write a GeoIndex of each GMTCO file resampled to file.idx
+	double	gridres;	// if not 0, grid each band resampled to file.grid in cells of gridres degrees
+	int	gridthreads;	// threads gridding the bands, shared by all of them
+	const Region	*region;	// part of the granule to resample, or NULL for all
+	FILE	*report;	// if not NULL, a JSON record of each file resampled is written to it
+};
+
+// Geolocation of a granule and its sorting indices,
+// shared by all the bands resampled with it.
+struct GeoPlan {
+	char	geofile[1024];	// GMODO file
+	Mat	lat, lon;
+	Mat	sind;	// sorting indices
+	int	top, bottom;	// rows of the granules before and after it in lat, lon and sind
+};
+
+// Rows of a band or GMTCO file shared with the files of the granules
+// before and after it in a swath, as they were before being resampled.
+// Top and bottom hold an image of SEAMROWS rows for each dataset
+// resampled, or nothing if there is no such neighbor.
+struct Seam {
+	vector<Mat>	top, bottom;
+	float	scale[2], offset[2];	// band scaling of top and bottom
+};
+
+// Latitude/longitude box. Like a Region, lonmin > lonmax if it
+// crosses the antimeridian. It's empty if latmin > latmax.
+struct GeoBox {
+	float	latmin, latmax;
+	float	lonmin, lonmax;
+};
+
+// Spatial index of the geolocation of a granule (see index.cc):
+// the box of each cell of a scan by INDEXCOLS columns, and a tree
+// of the boxes of the scans.
+struct GeoIndex {
+	int	rows, cols;	// of the geolocation indexed
+	int	nscans, nblocks;	// cells along and across the track
+	vector<GeoBox>	cells;	// scan after scan
+	vector<GeoBox>	tree;	// tree[1] is the root, tree[2*i] and tree[2*i+1] the children of tree[i]
+};
+
+#define INDEX_MAGIC	"VIIRSIDX"
+
+// Header of an index file, followed by the cells of the GeoIndex.
+struct IndexHdr {
+	char	magic[8];	// INDEX_MAGIC
+	int	rows, cols;
+	int	cellrows, cellcols;	// NDETECTORS and INDEXCOLS
+	int	nscans, nblocks;
+	char	pad[32];
+};
+
+// plane.cc
+void *plane_alloc(size_t n);
+void plane_free(void *p);
+Status viirs_hugepages(const char *mode);
+
+// Allocate an n1 x n2 image as an array of row pointers into a
+// single plane from plane_alloc, so p[0] is the whole image.
+// Returns NULL on error.
+template <class T>
+T**
+alloc2d(int n1, int n2)
+{
+	T **p = (T**)malloc(n1*sizeof(T*));
+	if(p == NULL){
+		return NULL;
+	}
+	p[0] = (T*)plane_alloc((size_t)n1*n2*sizeof(T));
+	if(p[0] == NULL){
+		free(p);
+		return NULL;
+	}
+	for(int i = 1; i < n1; i++){
+		p[i] = p[0] + (size_t)i*n2;
+	}
+	return p;
+}
+
+template <class T>
+void
+free2d(T **p)
+{
+	if(p != NULL){
+		plane_free(p[0]);
+		free(p);
+	}
+}
+
+// isa.cc
+// Instruction set variants of the resampling kernels.
+enum {
+	ISA_GENERIC,
+	ISA_SSE42,
+	ISA_AVX2,
+	ISA_AVX512,
+	NISAS,
+};
+
+int isa_current();
+const char *isa_name(int isa);
+Status viirs_isa(const char *name);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ISA_SSE42_TARGET	__attribute__((target("sse4.2")))
+#define ISA_AVX2_TARGET	__attribute__((target("avx2")))
+#define ISA_AVX512_TARGET	__attribute__((target("avx512f,avx512bw,avx512dq,avx512vl")))
+#else
+#define ISA_SSE42_TARGET
+#define ISA_AVX2_TARGET
+#define ISA_AVX512_TARGET
+#endif
+
+#define ALWAYS_INLINE	inline __attribute__((always_inline))
+
+// Define the kernel name, with parameters params and arguments args
+// in parentheses, for each instruction set as a static function
+// calling name_, which must be ALWAYS_INLINE so each copy of its body
+// is compiled for that instruction set. The variants are in the table
+// name_isa indexed by ISA_*, so the kernel is called as
+// name_isa[isa_current()] args.
+#define ISA_KERNEL(name, params, args) \
+	static void name##_generic params { name##_ args; } \
+	ISA_SSE42_TARGET static void name##_sse42 params { name##_ args; } \
+	ISA_AVX2_TARGET static void name##_avx2 params { name##_ args; } \
+	ISA_AVX512_TARGET static void name##_avx512 params { name##_ args; } \
+	static void (*const name##_isa[NISAS]) params = { \
+		name##_generic, name##_sse42, name##_avx2, name##_avx512, \
+	};
+
+// Buffer allocated with plane_alloc by the readwrite functions.
+// It is freed when it goes out of scope, so that
+// nothing is leaked when an error is thrown.
+template <class T>
+struct Cbuf {
+	T	*p;
+
+	Cbuf() : p(NULL) {}
+	~Cbuf() { plane_free(p); }
+
+private:
+	Cbuf(const Cbuf&);
+	Cbuf &operator=(const Cbuf&);
 };
 
-// allocate_2d.cc
-float ** allocate_2d_f(int n1, int n2);
-int ** allocate_2d_i(int n1, int n2);
+// Stages timed in a Report. The I/O stages come first.
+enum {
+	STAGE_H5OPEN,
+	STAGE_H5READ,
+	STAGE_H5WRITE,
+	STAGE_ATTR,	// reading or writing the resampling attribute
+	NIOSTAGES,
+	STAGE_CONVERT = NIOSTAGES,	// band to physical units
+	STAGE_SORTIND,	// getadjustedsortingind
+	STAGE_SORT,	// resample_sort
+	STAGE_RESAMPLE,	// resample2d
+	STAGE_REQUANT,	// physical units to band
+	STAGE_FUSED,	// resample_band_fused
+	STAGE_GRID,	// grid_band
+	NSTAGES,
+};
+
+// Pixels counted in a Report.
+enum {
+	COUNT_PIXELS,	// resampled and written back
+	COUNT_BOWTIE,	// bow-tie deleted pixels filled in
+	COUNT_CLAMPED,	// out of the range of the band type after resampling
+	NCOUNTS,
+};
+
+// Timing and I/O statistics of resampling a file.
+struct Report {
+	double	t0;	// start time
+	double	secs[NSTAGES];	// time spent in each stage
+	double	bytesread, byteswritten;	// dataset bytes
+	double	counts[NCOUNTS];
+};
+
+// Sets the report of the file the thread is working on for its scope.
+struct ReportScope {
+	Report	*old;
+
+	ReportScope(Report *r);
+	~ReportScope();
+};
+
+// Adds the time of its scope to a stage of the thread's current report,
+// and for the I/O stages to the latency histograms of the metrics.
+struct Timer {
+	Report	*rep;	// NULL if the thread has no report
+	Timer	*parent;	// enclosing timer
+	int	stage;
+	bool	on;	// timing the scope
+	double	t0, child;
+
+	Timer(int stage);
+	~Timer();
+};
+
+// Scope of the workspace planes handed out by wsmat.
+struct WsScope {
+	int	mark;	// planes in use when the scope began
+
+	WsScope();
+	~WsScope();
+
+private:
+	WsScope(const WsScope&);
+	WsScope &operator=(const WsScope&);
+};
+
+// Intermediates of resampling that can be captured.
+enum {
+	CAP_BEFORE,	// image to resample
+	CAP_LAT,
+	CAP_LON,
+	CAP_SIND,	// sorting indices
+	CAP_SIMG,	// sorted image
+	CAP_SLAT,
+	CAP_SLON,
+	CAP_RES,	// spatial resolution of each column
+	CAP_AFTER,	// resampled sorted image
+	CAP_ILON,	// interpolated sorted longitude
+	CAP_FINAL,	// resampled image
+	CAP_TCLAT,	// terrain-corrected geolocation
+	CAP_TCLON,
+	CAP_TCSLAT,	// sorted terrain-corrected geolocation
+	CAP_TCSLON,
+	CAP_TCLATP,	// resampled terrain-corrected geolocation
+	CAP_TCLONP,
+	NCAPS,
+};
+
+#define CAPTURE_MAGIC	"VIIRSCAP"
+
+// Header of a capture file, followed by the rows of the image.
+struct CaptureHdr {
+	char	magic[8];	// CAPTURE_MAGIC
+	int	rows, cols;
+	int	type;	// OpenCV type of the image, such as CV_32FC1
+	int	elemsize;	// bytes per element
+	char	name[16];	// intermediate captured, such as "sind"
+	char	pad[24];
+};
+
+// Names the captures made by the thread after a file for its scope.
+struct CaptureScope {
+	const char	*old;
+
+	CaptureScope(const char *file);
+	~CaptureScope();
+};
+
+// granule.cc
+int getfiletype(const char *path);
+int getbandname(const char *h5file);
+void resamopts_init(ResamOpts *opts);
+Status viirs_resample_band(const char *geofile, const char *h5file, const ResamOpts *opts);
+Status viirs_geoplan_create(const char *geofile, GeoPlan **plan);
+void viirs_geoplan_free(GeoPlan *plan);
+Status viirs_resample_band_plan(const GeoPlan *plan, const char *h5file, const ResamOpts *opts);
+struct BandJob;
+Status viirs_band_read(const char *geofile, const GeoPlan *plan, const char *h5file,
+	const ResamOpts *opts, BandJob **job);
+Status viirs_band_compute(BandJob *job);
+Status viirs_band_write(BandJob *job);
+void viirs_band_free(BandJob *job);
+void band2physbuf(const ushort *band, int n, double scale, double offset, float *phys);
+void band2physbuf(const float *band, int n, double scale, double offset, float *phys);
+void phys2bandbuf(const float *phys, const ushort *simg, const Mat &sind, int sx, int sy,
+	double scale, double offset, bool gaponly, ushort *band);
+void phys2bandbuf(const float *phys, const float *simg, const Mat &sind, int sx, int sy,
+	double scale, double offset, bool gaponly, float *band);
+Status viirs_band_read_swath(const GeoPlan *plan, const char *h5file, const Seam *seam,
+	const ResamOpts *opts, BandJob **job);
+Status viirs_resample_tcgeo(const char *gmodofile, const char *gmtcofile, const ResamOpts *opts);
+Status viirs_resample_tcgeo_swath(const GeoPlan *plan, const char *gmtcofile, const Seam *seam,
+	const ResamOpts *opts);
+int viirs_datasets(const char *file, char names[][128]);
+Status viirs_resampled(const char *file, bool *done);
+Status viirs_sort_latlon(const char *geofile);
+Status viirs_reorder_ghrsst(const char *ncfile);
+Status viirs_reorder_acspo(const char *ncfile);
+
+// stitch.cc
+Status viirs_geoplan_swath(const char *prevgeo, const char *geofile, const char *nextgeo, GeoPlan **plan);
+Status viirs_seam_read(const char *file, const char *nextfile, Seam *carry, Seam *seam, const ResamOpts *opts);
+
+// grid.cc
+// Mean of band values over a regular latitude/longitude grid.
+struct Grid {
+	double	res;	// cell size in degrees
+	double	lat0, lon0;	// south-west corner of the grid; row 0 is the southernmost
+	int	rows, cols;
+	Mat	mean;	// CV_32FC1 physical values, NA_FLOAT32_FILL in empty cells
+	Mat	count;	// CV_32SC1 pixels averaged in each cell
+};
+void grid_band(const Mat &img, double scale, double offset, const Mat &lat, const Mat &lon,
+	double res, int nthreads, Grid *g);
+void grid_write(const Grid *g, const char *path, const char *name);
+
+// index.cc
+Status viirs_geoindex_build(const Mat &lat, const Mat &lon, GeoIndex **idx);
+Status viirs_geoindex_write(const GeoIndex *idx, const char *path);
+Status viirs_geoindex_read(const char *path, GeoIndex **idx);
+void viirs_geoindex_free(GeoIndex *idx);
+int viirs_geoindex_query(const GeoIndex *idx, const GeoBox *box, vector<Rect> &blocks);
+int viirs_geoindex_point(const GeoIndex *idx, float lat, float lon, vector<Rect> &blocks);
+
+// batch.cc
+Status viirs_resample_file(const char *geofile, const char *file, const ResamOpts *opts);
+Status viirs_run_batch(const char *manifest, int nthreads, const char *summary, const ResamOpts *opts);
+
+// spool.cc
+Status viirs_run_spool(const char *indir, const char *outdir, const bool *want, int nthreads,
+	const ResamOpts *opts);
+
+// server.cc
+Status viirs_run_server(const char *sockpath, int nthreads, int ncache, const ResamOpts *opts);
+
+// io.cc
+// All HDF5 and netCDF calls are made by a single I/O thread, because
+// the libraries are usually not built thread-safe.
+struct IOReq;
+IOReq *io_submit(void (*fn)(void *arg), void *arg);
+void io_wait(IOReq *r);
+void io_call(void (*fn)(void *arg), void *arg);
+
+// report.cc
+void report_init(Report *r);
+Report *report_current();
+const char *report_stagename(int stage);
+void report_bytes(double nread, double nwritten);
+void report_count(int c, double n);
+void report_end(FILE *f, const Report *r, const char *geofile, const char *file, const Status *st);
+
+// metrics.cc
+void metrics_file(const Report *r, const Status *st);
+void metrics_granule();
+void metrics_io(int stage, double secs);
+Status metrics_start(const char *path, int interval);
+void metrics_flush();
+
+// capture.cc
+extern uvlong capturemask;
+void capture_put(int what, const Mat &m);
+Status viirs_capture(const char *stages, const char *dir);
+void capture_flush();
+
+inline bool
+capturing(int what)
+{
+	return __atomic_load_n(&capturemask, __ATOMIC_RELAXED) & (1ULL<<what);
+}
+
+// Capture intermediate m of kind what, if it's being captured.
+inline void
+capture(int what, const Mat &m)
+{
+	if(capturing(what))
+		capture_put(what, m);
+}
+
+// workspace.cc
+Mat wsmat(int rows, int cols, int type);
+
+// pool.cc
+struct Pool;
+Pool *pool_create(int nthreads);
+void pool_submit(Pool *p, void (*fn)(void *arg), void *arg);
+void pool_wait(Pool *p);
+void pool_destroy(Pool *p);
+struct Queue;
+Queue *queue_create(int cap);
+bool queue_put(Queue *q, void *v);
+void *queue_get(Queue *q);
+void queue_close(Queue *q);
+void queue_free(Queue *q);
 
 // readwrite.cc
 int readwrite_viirs(unsigned short **buffer, unsigned long long * dimsizes, float * gain, float * offset, 
                     char * filename, char * BTstr, int readwrite);
 int readwrite_viirs_float(float **buffer, unsigned long long * dimsizes, const char * filename, const char * BTstr, int readwrite);
 int write_viirs_attribute(const char *filename, const char *attrFieldStr, const char *attrNameStr, float destrval);
+int readwrite_viirs_rows(unsigned short **buffer, unsigned long long * dimsizes, float * gain, float * offset,
+                    const char * filename, const char * BTstr, int readwrite, int row0, int nrows);
+int readwrite_viirs_float_rows(float **buffer, unsigned long long * dimsizes, const char * filename, const char * BTstr,
+                    int readwrite, int row0, int nrows);
+int write_viirs_attribute_rows(const char *filename, const char *attrFieldStr, const char *attrNameStr, int row0, int row1);
+int read_viirs_attribute_rows(const char *filename, const char *attrFieldStr, const char *attrNameStr,
+	vector<int> &extents);
+int delete_viirs_attribute(const char *filename, const char *attrFieldStr, const char *attrNameStr);
+int viirs_attribute_exists(const char *filename, const char *attrFieldStr, const char *attrNameStr);
+int viirs_dimsizes(const char *filename, const char *BTstr, unsigned long long *dimsizes);
+void h5closeall();
+Status viirs_h5driver(const char *name);
 
 // readwrite_ghrisst.cc
 void ncfatal(int n, const char *fmt, ...);
@@ -65,13 +535,20 @@ int ghrsst_readwrite(int ncid, const char *name, Mat &img, bool dowrite);
 void create_viirs(Mat data, const char *filename, const char *varname);
 
 // resample.cc
-void resample_viirs_mat(Mat &img, Mat &lat, Mat &lon, bool sortoutput);
-void resample_viirs(float **imgarr, float **latarr, float **lonarr, int nx, int ny, bool sortoutput);
+double geodist(double lat1, double lon1, double lat2, double lon2);
+bool validgeo(float lat, float lon);
+void resample_viirs_mat(Mat &img, Mat &lat, Mat &lon, bool sortoutput, bool gaponly);
+void resample_viirs_mat(vector<Mat> &imgs, Mat &lat, Mat &lon, bool sortoutput, bool gaponly);
+void resample_viirs(float **imgarr, float **latarr, float **lonarr, int nx, int ny, bool sortoutput, bool gaponly);
 void getsortingind(Mat &sind, int height);
 void getadjustedsortingind(Mat &sind, const Mat &lat);
 Mat resample_sort(const Mat &sind, const Mat &img);
+void resample_sort(const Mat &sind, const Mat &img, Mat &dst);
+void interplon(const int *sind, const float *slon, const float *lon, int n, float *dst);
+void resample2d(const Mat &sortidx, const vector<Mat> &ssrc, const Mat &slat, const Mat &slon,
+	const Mat &lon, bool gaponly, vector<Mat> &dst, Mat &ilon);
+void resample_band_fused(const Mat &sind, Mat &img, const Mat &lat, const Mat &lon,
+	double scale, double offset, bool gaponly, Mat *simg, Mat *slat, Mat *ilon);
 
 // utils.cc
 void	eprintf(const char *fmt, ...);
-void dumpmat(const char *filename, Mat &m);
-void dumpfloat(const char *filename, float *buf, int nbuf);
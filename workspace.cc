@@ -0,0 +1,124 @@
+//
+// Per-thread arena of image planes reused across bands and granules
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "viirsresam.h"
+
+struct Plane {
+	void	*p;
+	size_t	cap;	// bytes
+	bool	busy;	// handed out in a live scope
+};
+
+// Planes of a thread. Stack holds the busy planes in the order
+// they were handed out, so a scope can release the ones it took.
+struct Workspace {
+	vector<Plane>	planes;
+	vector<int>	stack;
+	int	depth;	// number of live WsScope
+};
+
+static pthread_once_t wsonce = PTHREAD_ONCE_INIT;
+static pthread_key_t wskey;
+
+static void
+freews(void *arg)
+{
+	Workspace *ws = (Workspace*)arg;
+
+	for(int i = 0; i < (int)ws->planes.size(); i++){
+		plane_free(ws->planes[i].p);
+	}
+	delete ws;
+}
+
+static void
+mkkey()
+{
+	pthread_key_create(&wskey, freews);
+}
+
+// Returns the workspace of this thread, creating it on first use.
+// It's freed when the thread exits.
+static Workspace*
+getws()
+{
+	pthread_once(&wsonce, mkkey);
+	Workspace *ws = (Workspace*)pthread_getspecific(wskey);
+	if(ws == NULL){
+		ws = new Workspace;
+		ws->depth = 0;
+		pthread_setspecific(wskey, ws);
+	}
+	return ws;
+}
+
+// Planes handed out by wsmat during the scope are returned to the
+// thread's workspace at its end.
+WsScope::WsScope()
+{
+	Workspace *ws = getws();
+
+	mark = ws->stack.size();
+	ws->depth++;
+}
+
+WsScope::~WsScope()
+{
+	Workspace *ws = getws();
+
+	while((int)ws->stack.size() > mark){
+		ws->planes[ws->stack.back()].busy = false;
+		ws->stack.pop_back();
+	}
+	ws->depth--;
+}
+
+// Returns an uninitialized rows x cols image of the given type
+// backed by a plane of the thread's workspace, which stays valid
+// until the innermost WsScope ends. The planes are kept, already
+// faulted in, for the following scopes. Outside of a scope, a newly
+// allocated image is returned.
+//
+Mat
+wsmat(int rows, int cols, int type)
+{
+	Workspace *ws = getws();
+	int k;
+
+	if(ws->depth == 0){
+		return Mat(rows, cols, type);
+	}
+	size_t n = (size_t)rows*cols*CV_ELEM_SIZE(type);
+
+	// smallest free plane large enough, or else any free plane to grow
+	k = -1;
+	for(int i = 0; i < (int)ws->planes.size(); i++){
+		Plane *pl = &ws->planes[i];
+		if(pl->busy)
+			continue;
+		if(k < 0 || (pl->cap >= n && (ws->planes[k].cap < n || pl->cap < ws->planes[k].cap)))
+			k = i;
+	}
+	if(k < 0){
+		Plane pl = {NULL, 0, false};
+		ws->planes.push_back(pl);
+		k = ws->planes.size() - 1;
+	}
+	Plane *pl = &ws->planes[k];
+	if(pl->cap < n){
+		plane_free(pl->p);
+		pl->cap = 0;
+		pl->p = plane_alloc(n);
+		if(pl->p == NULL){
+			eprintf("cannot allocate %zu bytes for workspace", n);
+		}
+		pl->cap = n;
+	}
+	pl->busy = true;
+	ws->stack.push_back(k);
+	return Mat(rows, cols, type, pl->p);
+}